@@ -7,8 +7,6 @@
 #include "../rtos/os.h"
 #include "../uart/uart.h"
 
-unsigned int IdlePID;
-
 MUTEX bluetooth_mutex;
 MUTEX ls_mutex;
 MUTEX adc_mutex;
@@ -70,13 +68,6 @@ int buffer_dequeue(int *queue, int *front, int *rear) {
   return result;
 }
 
-// An idle task that runs when there is nothing else to do
-// Could be changed later to put CPU into low power state
-void Idle() {
-    for(;;) {
-    }
-}
-
 void InitADC() {
     ADMUX |= (1<<REFS0);
     ADCSRA|=(1<<ADEN)|(1<<ADPS0)|(1<<ADPS1)|(1<<ADPS2); //ENABLE ADC, PRESCALER 128
@@ -302,7 +293,6 @@ void a_main() {
     Task_Create(LaserTask, 2, 1);
     Task_Create(RoombaTask, 2, 1);
     Task_Create(bluetoothReceive, 2, 1);
-    IdlePID = Task_Create(Idle, MINPRIORITY, 1);
     Task_Create(SwitchTask, 2, 2);
 
     Task_Terminate();
@@ -0,0 +1,368 @@
+#define F_CPU 16000000
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "../rtos/os.h"
+#include "../sim/sim.h"
+
+/**
+  * Kernel primitive micro-benchmarks, run under simavr with "make bench".
+  *
+  * Every primitive is measured SAMPLES times with the OS_Cycles() counter,
+  * from the last instruction of one task before the kernel call to the first
+  * instruction of the task that runs next. The set is repeated while filler
+  * tasks are added one at a time (alternately parked in the ready queue and
+  * the sleep queue) until MAXTHREAD tasks exist.
+  *
+  * Every way a higher priority task can become ready (create, resume, event,
+  * mutex hand-off, sleep expiry) has its own wakeup benchmark, "max" is the
+  * worst case latency of that path.
+  *
+  * The report is written to the simavr console as CSV:
+  *
+  *   primitive,tasks,samples,min,avg,max
+  *
+  * where "tasks" counts every live task, including a_main and the filler
+  * tasks, and min/avg/max are CPU cycles with the counter overhead removed.
+  *
+  * It is followed by the stack use of the tasks still alive and of the
+  * interrupt stack ("isr", pid 0), "free" being the bytes never touched:
+  *
+  *   stack,pid,size,free
+  */
+
+#define SAMPLES       32
+#define BENCH_TASKS   3     /** a_main plus the two tasks under test */
+
+/** Timestamp taken just before handing the CPU to the kernel */
+volatile uint32_t stamp;
+
+/** Cost of reading the cycle counter, subtracted from every sample */
+uint32_t overhead;
+
+/** Set by the measuring task once it has all of its samples */
+volatile int finished;
+
+/** Results for the primitive being measured */
+uint32_t sampleMin;
+uint32_t sampleMax;
+uint32_t sampleSum;
+int sampleCount;
+
+/** The task under test, for primitives that name their target */
+PID highPid;
+
+/** The filler tasks, for the stack report */
+PID fillerPid[MAXTHREAD];
+
+EVENT done;
+EVENT go;
+EVENT evt;
+
+MUTEX mtx;
+
+// ------------------------------ SAMPLES ------------------------------ //
+void Bench_Reset() {
+	sampleMin = 0xFFFFFFFF;
+	sampleMax = 0;
+	sampleSum = 0;
+	sampleCount = 0;
+	finished = 0;
+}
+
+void Bench_Sample(uint32_t now) {
+	uint32_t cycles = now - stamp;
+
+	cycles = (cycles > overhead) ? cycles - overhead : 0;
+
+	if (cycles < sampleMin) {
+		sampleMin = cycles;
+	}
+	if (cycles > sampleMax) {
+		sampleMax = cycles;
+	}
+	sampleSum += cycles;
+	sampleCount++;
+}
+
+void Bench_Stamp() {
+	CRITICAL_STATE sreg = OS_CriticalEnter();
+
+	stamp = Sim_Cycles();
+
+	OS_CriticalExit(sreg);
+}
+
+void Bench_Report(const char *primitive, int tasks) {
+	Sim_Putc(SIM_TAG);
+	Sim_Puts(primitive);
+	Sim_Putc(',');
+	Sim_PutUnsigned(tasks);
+	Sim_Putc(',');
+	Sim_PutUnsigned(sampleCount);
+	Sim_Putc(',');
+	Sim_PutUnsigned(sampleMin);
+	Sim_Putc(',');
+	Sim_PutUnsigned(sampleCount ? sampleSum / sampleCount : 0);
+	Sim_Putc(',');
+	Sim_PutUnsigned(sampleMax);
+	Sim_Putc('\n');
+}
+
+void Bench_Calibrate() {
+	int i;
+	uint32_t t0;
+	uint32_t t1;
+
+	overhead = 0xFFFFFFFF;
+
+	for (i = 0; i < 8; i++) {
+		t0 = Sim_Cycles();
+		t1 = Sim_Cycles();
+		if (t1 - t0 < overhead) {
+			overhead = t1 - t0;
+		}
+	}
+}
+
+// ------------------------------ FILLER TASKS ------------------------------ //
+void Filler_Ready() {
+	for(;;) {
+		Task_Next();
+	}
+}
+
+void Filler_Sleep() {
+	for(;;) {
+		Task_Sleep(60000);
+	}
+}
+
+// ------------------------------ CONTEXT SWITCH ------------------------------ //
+// Two equal priority tasks hand the CPU back and forth with Task_Next()
+void Switch_Task() {
+	while (!finished) {
+		if (stamp != 0) {
+			Bench_Sample(Sim_Cycles());
+
+			if (sampleCount >= SAMPLES) {
+				finished = 1;
+				Event_Signal(done);
+				return;
+			}
+		}
+
+		Bench_Stamp();
+		Task_Next();
+	}
+}
+
+// ------------------------------ MUTEX HAND-OFF ------------------------------ //
+// The low priority owner unlocks while the high priority task is blocked on it
+void Mutex_High() {
+	for(;;) {
+		Event_Wait(go);
+		Mutex_Lock(mtx);
+		Bench_Sample(Sim_Cycles());
+		Mutex_Unlock(mtx);
+
+		if (sampleCount >= SAMPLES) {
+			finished = 1;
+			Event_Signal(done);
+			return;
+		}
+	}
+}
+
+void Mutex_Low() {
+	while (!finished) {
+		Mutex_Lock(mtx);
+		Event_Signal(go);
+		Bench_Stamp();
+		Mutex_Unlock(mtx);
+	}
+}
+
+// ------------------------------ EVENT WAKEUP ------------------------------ //
+// The low priority task signals while the high priority task waits
+void Event_High() {
+	for(;;) {
+		Event_Wait(evt);
+		Bench_Sample(Sim_Cycles());
+
+		if (sampleCount >= SAMPLES) {
+			finished = 1;
+			Event_Signal(done);
+			return;
+		}
+	}
+}
+
+void Event_Low() {
+	while (!finished) {
+		Bench_Stamp();
+		Event_Signal(evt);
+	}
+}
+
+// ------------------------------ NOTIFY WAKEUP ------------------------------ //
+// The same hand-off as event_wakeup, through the target's notification bits
+void Notify_High() {
+	for(;;) {
+		Task_NotifyWait(1, NOTIFY_FOREVER);
+		Bench_Sample(Sim_Cycles());
+
+		if (sampleCount >= SAMPLES) {
+			finished = 1;
+			Event_Signal(done);
+			return;
+		}
+	}
+}
+
+void Notify_Low() {
+	while (!finished) {
+		Bench_Stamp();
+		Task_Notify(highPid, 1, NOTIFY_SET_BITS);
+	}
+}
+
+// ------------------------------ CREATE PREEMPT ------------------------------ //
+// The low priority task creates a high priority task, which runs at once
+void Create_High() {
+	Bench_Sample(Sim_Cycles());
+
+	if (sampleCount >= SAMPLES) {
+		finished = 1;
+		Event_Signal(done);
+	}
+}
+
+void Create_Low() {
+	while (!finished) {
+		Bench_Stamp();
+		Task_Create(Create_High, 1, 0);
+	}
+}
+
+// ------------------------------ RESUME PREEMPT ------------------------------ //
+// The high priority task suspends itself and the low priority task resumes it
+void Resume_High() {
+	for(;;) {
+		Task_Suspend(highPid);
+		Bench_Sample(Sim_Cycles());
+
+		if (sampleCount >= SAMPLES) {
+			finished = 1;
+			Event_Signal(done);
+			return;
+		}
+	}
+}
+
+void Resume_Low() {
+	while (!finished) {
+		Bench_Stamp();
+		Task_Resume(highPid);
+	}
+}
+
+// ------------------------------ SLEEP TICK ------------------------------ //
+// A low priority spinner keeps stamping until the tick wakes the sleeper,
+// so each sample covers timer ISR entry, the sleep queue scan and the switch
+void Sleep_High() {
+	for(;;) {
+		Task_Sleep(1);
+		Bench_Sample(Sim_Cycles());
+
+		if (sampleCount >= SAMPLES) {
+			finished = 1;
+			Event_Signal(done);
+			return;
+		}
+	}
+}
+
+void Sleep_Low() {
+	while (!finished) {
+		Bench_Stamp();
+	}
+}
+
+// ------------------------------ DRIVER ------------------------------ //
+void Bench_Run(const char *primitive, voidfuncptr high, PRIORITY highPy, voidfuncptr low, PRIORITY lowPy, int tasks) {
+	Bench_Reset();
+	stamp = 0;
+
+	// Some primitives create their high priority task themselves
+	if (high != NULL) {
+		highPid = Task_Create(high, highPy, 0);
+	}
+	Task_Create(low, lowPy, 0);
+
+	Event_Wait(done);
+
+	// Let the task left behind see "finished" and terminate
+	Task_Sleep(1);
+
+	Bench_Report(primitive, tasks);
+}
+
+void Bench_Stack(const char *name, PID p, unsigned int size, unsigned int free) {
+	Sim_Putc(SIM_TAG);
+	Sim_Puts(name);
+	Sim_Putc(',');
+	Sim_PutUnsigned(p);
+	Sim_Putc(',');
+	Sim_PutUnsigned(size);
+	Sim_Putc(',');
+	Sim_PutUnsigned(free);
+	Sim_Putc('\n');
+}
+
+// Application level main function
+// Runs every benchmark for each task count and then stops the simulator
+void a_main() {
+	int fillers;
+	PID self = Task_GetPid();
+
+	Bench_Calibrate();
+
+	done = Event_Init();
+	go = Event_Init();
+	evt = Event_Init();
+	mtx = Mutex_Init();
+
+	Sim_Putc(SIM_TAG);
+	Sim_Puts("primitive,tasks,samples,min,avg,max\n");
+
+	for (fillers = 0; fillers + BENCH_TASKS <= MAXTHREAD; fillers++) {
+		if (fillers > 0) {
+			if (fillers % 2) {
+				fillerPid[fillers] = Task_Create(Filler_Ready, MINPRIORITY, 0);
+			}
+			else {
+				fillerPid[fillers] = Task_Create(Filler_Sleep, MINPRIORITY, 0);
+			}
+		}
+
+		Bench_Run("cswitch", Switch_Task, 1, Switch_Task, 1, fillers + BENCH_TASKS);
+		Bench_Run("mutex_handoff", Mutex_High, 1, Mutex_Low, 2, fillers + BENCH_TASKS);
+		Bench_Run("event_wakeup", Event_High, 1, Event_Low, 2, fillers + BENCH_TASKS);
+		Bench_Run("notify_wakeup", Notify_High, 1, Notify_Low, 2, fillers + BENCH_TASKS);
+		Bench_Run("sleep_tick", Sleep_High, 1, Sleep_Low, 2, fillers + BENCH_TASKS);
+		Bench_Run("create_preempt", NULL, 1, Create_Low, 2, fillers + BENCH_TASKS);
+		Bench_Run("resume_preempt", Resume_High, 1, Resume_Low, 2, fillers + BENCH_TASKS);
+	}
+
+	Sim_Putc(SIM_TAG);
+	Sim_Puts("stack,pid,size,free\n");
+
+	Bench_Stack("a_main", self, WORKSPACE, Task_StackFree(self));
+	for (fillers = 1; fillers + BENCH_TASKS <= MAXTHREAD; fillers++) {
+		Bench_Stack("filler", fillerPid[fillers], WORKSPACE, Task_StackFree(fillerPid[fillers]));
+	}
+	Bench_Stack("isr", 0, ISRSTACK, OS_IsrStackFree());
+
+	Sim_Exit();
+}
@@ -5,6 +5,7 @@
 #include <util/delay.h>
 #include "../roomba/roomba.h"
 #include "../rtos/os.h"
+#include "../rtos/seqlock.h"
 #include "../uart/uart.h"
 
 uint8_t LASER = 0;
@@ -14,30 +15,57 @@ uint8_t SCREEN = 3;
 uint8_t ROOMBA = 4;
 uint8_t MODE = 5;
 
-uint8_t IdlePID;
-uint8_t RoombaTestPID;
-uint8_t RoombaTaskPID;
-uint8_t BluetoothSendPID;
-uint8_t BluetoothReceivePID;
-uint8_t LaserTaskPID;
-uint8_t ServoTaskPID;
-uint8_t LightSensorTaskPID;
-uint8_t GetSensorDataTaskPID;
+PID RoombaTestPID;
+PID RoombaTaskPID;
+PID BluetoothReceivePID;
+PID LaserTaskPID;
+PID ServoTaskPID;
+PID GetSensorDataTaskPID;
+PID RoombaInitPID;
+
+BASIC BluetoothSendJob;
+BASIC LightSensorJob;
 
 int laserState;
 int servoState;
 int lastServoState;
 char roombaState;
-int wallState;
-int bumpState;
 
-uint16_t photocellReading;
+// Sensor readings, published by Get_Sensor_Data()
+typedef struct sensor_data {
+	int wall;
+	int bump;
+} SENSOR_DATA;
+
+SEQ_BUFFER(SENSOR_DATA) sensorData;
+
+// Published by LightSensor_Task()
+SEQ_BUFFER(uint16_t) photocellReading;
 uint16_t photoThreshold;
 
 int AUTO;
 
-// An idle task that runs when there is nothing else to do
-// Could be changed later to put CPU into low power state
+// Operating modes, switched by the MODE command. While it drives on its own
+// Roomba_Task runs ahead of the other tasks and the sensors are polled twice
+// as often, so its wall and bump reflexes are not held up. The laser is only
+// fired by hand, Laser_Task is parked in AUTO_MODE
+#define MANUAL_MODE				0
+#define AUTO_MODE				1
+
+#define ROOMBA_AUTO_PRIORITY	1
+#define ROOMBA_MANUAL_PRIORITY	2
+#define SENSOR_AUTO_PERIOD		12
+#define SENSOR_MANUAL_PERIOD	24
+
+// The priority 2 tasks run for a few hundred microseconds and then sleep,
+// so Bluetooth_Receive (priority 1) waits for them instead of preempting
+#define SHORT_RUN_THRESHOLD		1
+
+// Bluetooth_Receive is a deferrable server: a burst of radio commands gets
+// at most RADIO_BUDGET_US of CPU every RADIO_PERIOD ticks, the rest waits
+// (holding laserMutex it runs on, and is stopped once it unlocks)
+#define RADIO_BUDGET_US			5000
+#define RADIO_PERIOD			5
 
 typedef enum laser_states {
     OFF = 0,
@@ -70,7 +98,9 @@ int roombaRear;
 // Mutexes
 MUTEX laserMutex;
 MUTEX servoMutex;
-MUTEX sensorMutex;
+
+// Condition variables
+COND laserCond;		// laserQueue is not empty, with laserMutex
 
 // ------------------------------ IS FULL ------------------------------ //
 int buffer_isFull(int *front, int *rear) {
@@ -164,30 +194,28 @@ void Servo_Init() {
     OCR4A = 375; // 90 Degrees
 }
 
-// ------------------------------ IDLE TASK ------------------------------ //
-void Idle() {
-	for(;;) {
-		continue;
-	}
-}
-
 // ------------------------------ LASER TASK ------------------------------ //
 void Laser_Task() {
 	for(;;) {
+		// Parked here, with laserMutex free, while in AUTO_MODE
+		Mode_Boundary();
+
 		Mutex_Lock(laserMutex);
 
-		if(!buffer_isEmpty(&laserFront, &laserRear)) {
-			laserState = buffer_dequeue(laserQueue, &laserFront, &laserRear);
-			if (laserState == ON) {
-				enablePORTL5();
-			}
-			else {
-				disablePORTL5();
-			}
+		// Sleep until Bluetooth_Receive() queues a command
+		while(buffer_isEmpty(&laserFront, &laserRear)) {
+			Cond_Wait(laserCond, laserMutex);
+		}
+
+		laserState = buffer_dequeue(laserQueue, &laserFront, &laserRear);
+		if (laserState == ON) {
+			enablePORTL5();
+		}
+		else {
+			disablePORTL5();
 		}
 
 		Mutex_Unlock(laserMutex);
-		Task_Sleep(10);
 	}
 }
 
@@ -254,56 +282,64 @@ void Set_Photocell_Threshold() {
 }
 
 // ------------------------------ LIGHT SENSOR TASK ------------------------------ //
+// Basic task, runs to completion every 10 ticks on the shared runner stack
 void LightSensor_Task() {
-	int i = 0;
+	static int i = 0;
+	uint16_t reading;
 
-	for(;;) {
-		// Read photocell
-		ADMUX = (ADMUX & 0xE0);
+	// Read photocell
+	ADMUX = (ADMUX & 0xE0);
 
-		ADMUX = (ADMUX | 0x07); // Channel 7
+	ADMUX = (ADMUX | 0x07); // Channel 7
 
-		ADCSRB |= (0<<MUX5);
+	ADCSRB |= (0<<MUX5);
 
-		ADCSRA |= (1<<ADSC); // Start conversion
+	ADCSRA |= (1<<ADSC); // Start conversion
 
-		while((ADCSRA)&(1<<ADSC));    //WAIT UNTIL CONVERSION IS COMPLETE
+	while((ADCSRA)&(1<<ADSC));    //WAIT UNTIL CONVERSION IS COMPLETE
 
-		photocellReading = ADC;
+	reading = ADC;
 
-		if (photocellReading >= (photoThreshold + 50)) {
-			enablePORTL2();
-			Roomba_Play(0);
-			disablePORTL5();
-			Roomba_Drive(0,0);
-			OS_Abort();
-		}
+	SEQ_WRITE(photocellReading, reading);
 
-		if(i % 5 == 0) {
-			Set_Photocell_Threshold();
-			i = 0;
-		}
-		else {
-			i++;
-		}
+	if (reading >= (photoThreshold + 50)) {
+		enablePORTL2();
+		Roomba_Play(0);
+		disablePORTL5();
+		Roomba_Drive(0,0);
+		OS_Abort();
+	}
 
-		Task_Sleep(10);
+	if(i % 5 == 0) {
+		Set_Photocell_Threshold();
+		i = 0;
+	}
+	else {
+		i++;
 	}
 }
 
 // ------------------------------ GET SENSOR DATA ------------------------------ //
 void Get_Sensor_Data() {
+	SENSOR_DATA *data;
+
+	Task_SetPeriod(SENSOR_MANUAL_PERIOD, 0, OVERRUN_SKIP, NULL);
+
 	for(;;) {
 		Roomba_QueryList(7, 13);
 
 		// while(!(UCSR3A & (1<<RXC3)));
 		Task_Sleep(2);
-		bumpState = Roomba_Receive_Byte();
+		data = SEQ_WRITE_BUFFER(sensorData);
+		data->bump = Roomba_Receive_Byte();
 		// while(!(UCSR3A & (1<<RXC3)));
 		Task_Sleep(2);
-		wallState = Roomba_Receive_Byte();
+		data->wall = Roomba_Receive_Byte();
 
-		Task_Sleep(20);
+		// Readers see both readings change together
+		SEQ_PUBLISH(sensorData);
+
+		Task_WaitPeriod();
 	}
 }
 
@@ -381,8 +417,12 @@ void Auto_Drive() {
 
 // ------------------------------ ROOMBA TASK ------------------------------ //
 void Roomba_Task() {
+	SENSOR_DATA sensors;
+
 	for(;;) {
-		if(wallState) {
+		SEQ_READ(sensorData, sensors);
+
+		if(sensors.wall) {
 			buffer_dequeue(roombaQueue, &roombaFront, &roombaRear);
 			Reverse();
 
@@ -392,7 +432,7 @@ void Roomba_Task() {
 				Roomba_Drive(ROOMBA_SPEED*2, IN_PLACE_CCW);
 			}
 		}
-		else if(bumpState >= 1 && bumpState <= 3) {
+		else if(sensors.bump >= 1 && sensors.bump <= 3) {
 			buffer_dequeue(roombaQueue, &roombaFront, &roombaRear);
 			Bump_Back();
 
@@ -417,15 +457,16 @@ void Roomba_Task() {
 }
 
 // ------------------------------ BLUETOOTH SEND ------------------------------ //
+// Basic task, runs to completion every 10 ticks on the shared runner stack
 void Bluetooth_Send() {
-	for(;;) {
-		// SEND LIGHT SENSOR DATA
-		Bluetooth_Send_Byte(PHOTO);
-		Bluetooth_Send_Byte(photocellReading>>8);
-		Bluetooth_Send_Byte(photocellReading);
+	uint16_t reading;
 
-		Task_Sleep(10);
-	}
+	SEQ_READ(photocellReading, reading);
+
+	// SEND LIGHT SENSOR DATA
+	Bluetooth_Send_Byte(PHOTO);
+	Bluetooth_Send_Byte(reading>>8);
+	Bluetooth_Send_Byte(reading);
 }
 
 // ------------------------------ BLUETOOTH RECIEVE ------------------------------ //
@@ -443,12 +484,16 @@ void Bluetooth_Receive() {
 			flag = Bluetooth_Receive_Byte();
 
 			if (flag == LASER){
-				Mutex_Lock(laserMutex);
-
 				laser_data = Bluetooth_Receive_Byte();
-				buffer_enqueue(laser_data, laserQueue, &laserFront, &laserRear);
 
-				Mutex_Unlock(laserMutex);
+				if(AUTO == 0) {
+					Mutex_Lock(laserMutex);
+
+					buffer_enqueue(laser_data, laserQueue, &laserFront, &laserRear);
+					Cond_Signal(laserCond);
+
+					Mutex_Unlock(laserMutex);
+				}
 			}
 
 			// else if (flag == SERVO){
@@ -471,12 +516,20 @@ void Bluetooth_Receive() {
 			else if (flag == MODE) {
 				if(AUTO == 1){
 					AUTO = 0;
+					Mode_Set(MANUAL_MODE);
 					while(!buffer_isEmpty(&roombaFront,&roombaRear)) {
 						buffer_dequeue(roombaQueue, &roombaFront, &roombaRear);
 					}
 				}
 				else {
 					AUTO = 1;
+					Mode_Set(AUTO_MODE);
+
+					// Laser_Task switches the laser off and parks
+					Mutex_Lock(laserMutex);
+					buffer_enqueue(OFF, laserQueue, &laserFront, &laserRear);
+					Cond_Signal(laserCond);
+					Mutex_Unlock(laserMutex);
 				}
 			}
 
@@ -488,6 +541,12 @@ void Bluetooth_Receive() {
 	}
 }
 
+// Runs the Roomba wake-up sequence and terminates, at the lowest priority
+// so that its busy waits only take time nothing else wants
+void Roomba_Init_Task() {
+	Roomba_Init();
+}
+
 // Application level main function
 // Creates the required tasks and then terminates
 void a_main() {
@@ -509,36 +568,53 @@ void a_main() {
 	// Initialize Mutexes
 	laserMutex = Mutex_Init();
 	servoMutex = Mutex_Init();
-	sensorMutex = Mutex_Init();
+
+	// Initialize Condition variables
+	laserCond = Cond_Init();
 
 	// Initialize Bluetooth and Roomba UART
 	Bluetooth_UART_Init();
 	Roomba_UART_Init();
 	ADC_init();
 	// Servo_Init();
-	Roomba_Init();
+
+	// Wake the Roomba in the background, its delays take over two seconds
+	RoombaInitPID = Task_Create(Roomba_Init_Task, MINPRIORITY, 0);
 
 	// Evaluate light
 	Set_Photocell_Threshold();
 
 	// Initialize Values
-	photocellReading = 0;
+	SEQ_WRITE(photocellReading, 0);
 	servoState = 375;
 	lastServoState = 375;
-	wallState = 0;
-	bumpState = 0;
 	roombaState = 'X';
 	AUTO = 0;
 
 	// Create Tasks
-	IdlePID 					= Task_Create(Idle, MINPRIORITY, 1);
 	BluetoothReceivePID 		= Task_Create(Bluetooth_Receive, 1, 3);
-	BluetoothSendPID 			= Task_Create(Bluetooth_Send, 2, 3);
+	Task_SetServer(BluetoothReceivePID, RADIO_BUDGET_US, RADIO_PERIOD);
+	BluetoothSendJob 			= Basic_Create(Bluetooth_Send, 2, 10);
 	LaserTaskPID 				= Task_Create(Laser_Task, 2, 3);
-	LightSensorTaskPID 			= Task_Create(LightSensor_Task, 2, 3);
+	LightSensorJob 				= Basic_Create(LightSensor_Task, 2, 10);
 	// ServoTaskPID 				= Task_Create(Servo_Task, 2, 3);
-	RoombaTaskPID 				= Task_Create(Roomba_Task, 2, 2);
+
+	// The Roomba tasks need the open interface to be up
+	Task_Join(RoombaInitPID, JOIN_FOREVER);
+	RoombaTaskPID 				= Task_Create(Roomba_Task, ROOMBA_MANUAL_PRIORITY, 2);
 	GetSensorDataTaskPID 		= Task_Create(Get_Sensor_Data, 2, 2);
 
+	Task_SetThreshold(LaserTaskPID, SHORT_RUN_THRESHOLD);
+	Task_SetThreshold(RoombaTaskPID, SHORT_RUN_THRESHOLD);
+	Task_SetThreshold(GetSensorDataTaskPID, SHORT_RUN_THRESHOLD);
+
+	// Declare both task sets, the station starts out driven by hand
+	Mode_Declare(LaserTaskPID, MANUAL_MODE, 2, 0);
+	Mode_Declare(RoombaTaskPID, MANUAL_MODE, ROOMBA_MANUAL_PRIORITY, 0);
+	Mode_Declare(RoombaTaskPID, AUTO_MODE, ROOMBA_AUTO_PRIORITY, 0);
+	Mode_Declare(GetSensorDataTaskPID, MANUAL_MODE, 2, SENSOR_MANUAL_PERIOD);
+	Mode_Declare(GetSensorDataTaskPID, AUTO_MODE, 2, SENSOR_AUTO_PERIOD);
+	Mode_Set(MANUAL_MODE);
+
 	Task_Terminate();
 }
\ No newline at end of file
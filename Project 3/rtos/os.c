@@ -1,14 +1,36 @@
 #include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include "os.h"
 #include "queue.h"
 
 //Comment out the following line to remove debugging code from compiled version.
 #define DEBUG
 
+#ifdef STATIC_CONFIG
+/**
+  * The application's task functions, from the OS_TASKS() list.
+  */
+#define OS_TASK_PROTO(f, pri, a, size)  extern void f();
+OS_TASKS(OS_TASK_PROTO)
+#else
 extern void a_main();
 
+/** Nothing is statically configured, every object is made at runtime */
+#define STATIC_TASKS    0
+#define STATIC_MUTEXES  0
+#define STATIC_EVENTS   0
+#endif
+
+#ifdef TRACE
+/**
+  * Scheduling trace hooks, see "sim/sim.c". Only built for the simulator.
+  */
+extern void Sim_TraceCreate(PID p, voidfuncptr f);
+extern void Sim_TraceDispatch(PID p);
+#endif
+
 /*===========
   * RTOS Internal
   *===========
@@ -35,35 +57,112 @@ extern void Exit_Kernel();    /* this is the same as CSwitch() */
   */
 void Task_Terminate(void);
 static void Dispatch();
+#ifndef OS_NO_MUTEX
 static void Kernel_Unlock_Mutex();
+#endif
+#ifndef OS_NO_RWLOCK
+static void Kernel_Unlock_RwLock();
+#endif
+#ifndef OS_NO_NOTIFY
+static void Kernel_Notify(PD *p, NOTIFY bits, unsigned char action);
+#endif
 
 /** 
   * Contained in cswitch.S, context switches to the kernel
   */ 
 extern void Enter_Kernel();
 
+#ifdef STATIC_CONFIG
+/**
+  * Each configured task gets a stack of exactly the size it asked for.
+  */
+#define OS_TASK_STACK(f, pri, a, size)  static unsigned char f##_Stack[size];
+OS_TASKS(OS_TASK_STACK)
+
+#define OS_TASK_PD(f, pri, a, size)     { .p = f##_PID, .state = READY, .py = pri, .inheritedPy = pri, .eWait = 99 },
+#define OS_TASK_INFO(f, pri, a, size)   { .workSpace = f##_Stack, .workSpaceSize = size, .code = f, .arg = a },
+#define OS_MUTEX_MTX(name)              { .m = name, .state = FREE },
+#define OS_EVENT_EVT(name)              { .e = name, .state = UNSIGNALLED },
+#else
+#define OS_TASKS(TASK)
+#define OS_MUTEXES(MUTEX)
+#define OS_EVENTS(EVENT)
+#endif
+
+/**
+  * Stacks for the tasks made at runtime by Task_Create().
+  */
+static unsigned char WorkSpace[MAXTHREAD - STATIC_TASKS][WORKSPACE];
+
 /**
   * This table contains ALL process descriptors. It doesn't matter what
-  * state a task is in.
+  * state a task is in. Statically configured tasks come first.
+  */
+static PD Process[MAXTHREAD] = { OS_TASKS(OS_TASK_PD) };
+
+/** A PID keeps the index of its process descriptor in PID_SLOT_BITS bits */
+typedef char PidSlotCheck[(MAXTHREAD <= (1 << PID_SLOT_BITS)) ? 1 : -1];
+
+/** The rest of a PID counts the tasks created, it wraps after this many */
+#define PID_GENERATIONS (1U << (8 * sizeof(PID) - PID_SLOT_BITS))
+
+/**
+  * Stack and creation details of each process, same index as Process[].
   */
-static PD Process[MAXTHREAD];
+static PINFO ProcessInfo[MAXTHREAD] = { OS_TASKS(OS_TASK_INFO) };
 
+#ifndef OS_NO_MUTEX
 /**
   * This table contains ALL mutexes. It doesn't matter what
   * state a mutex is in.
   */
-static MTX Mutex[MAXMUTEX];
+static MTX Mutex[MAXMUTEX] = { OS_MUTEXES(OS_MUTEX_MTX) };
+#endif
 
+#ifndef OS_NO_EVENT
 /**
   * This table contains ALL events. It doesn't matter what
   * state an event is in.
   */
-static EVT Event[MAXEVENT];
+static EVT Event[MAXEVENT] = { OS_EVENTS(OS_EVENT_EVT) };
+#endif
+
+#ifndef OS_NO_TIMER
+/**
+  * This table contains ALL software timers. It doesn't matter what
+  * state a timer is in.
+  */
+static TMR Timer[MAXTIMER];
+#endif
+
+#ifndef OS_NO_RWLOCK
+/**
+  * This table contains ALL reader-writer locks. It doesn't matter what
+  * state a lock is in.
+  */
+static RWL RwLock[MAXRWLOCK];
+#endif
+
+#ifndef OS_NO_BASIC
+/**
+  * This table contains ALL basic tasks. It doesn't matter what
+  * state a basic task is in.
+  */
+static BSC Basic[MAXBASIC];
+#endif
+
+#ifndef OS_NO_MODE
+/**
+  * This table contains the per mode settings of ALL tasks, see
+  * Mode_Declare(). Entries of terminated tasks never match a live PID.
+  */
+static MODE_TASK ModeTask[MAXMODETASK];
+#endif
 
 /**
   * The process descriptor of the currently RUNNING task.
   */
-volatile static PD* Cp; 
+static PD* Cp;
 
 /** 
   * Since this is a "full-served" model, the kernel is executing using its own
@@ -82,13 +181,23 @@ volatile unsigned char *KernelSp;
   */
 volatile unsigned char *CurrentSp;
 
+/**
+  * ISRs run their handlers on this stack through OS_IsrCall(), so a task's
+  * workspace only has to hold the registers an ISR saves on entry and not
+  * the handler's own call depth. IsrNesting counts the handlers running,
+  * only the outermost one switches stacks. (Used by cswitch.S.)
+  */
+unsigned char IsrStack[ISRSTACK];
+unsigned char *IsrStackTop = &(IsrStack[ISRSTACK-1]);
+volatile unsigned char IsrNesting = 0;
+
 /** 1 if kernel has been started; 0 otherwise. */
 volatile static unsigned int KernelActive;  
 
 /** number of active tasks */
 volatile static unsigned int Tasks; 
 
- /** Keeps track of the process id's. Always goes up. */
+ /** Generation of the next PID, 1 to PID_GENERATIONS - 1 */
 volatile static unsigned int pCount;
 
 /** Number of mutexes created so far */
@@ -100,34 +209,129 @@ volatile static unsigned int Events;
 /** Global tick overflow count */
 volatile unsigned int tickOverflowCount = 0;
 
+/** Upper 16 bits of OS_Cycles(), bumped on every Timer5 overflow */
+volatile static unsigned int cycleOverflowCount = 0;
+
+/** Number of system ticks since the kernel started, wraps around */
+volatile static TICK tickCount = 0;
+
+#ifndef OS_NO_TIMER
+/** Number of timers created so far */
+volatile static unsigned int Timers;
+
+/** The task that runs timer callbacks, NULL until the first timer exists */
+static PD *TimerTask = NULL;
+
+/** Tick count at which TimerTask has to run, valid while TimerArmed */
+volatile static TICK TimerNextExpiry;
+volatile static unsigned int TimerArmed = 0;
+#endif
+
+#ifndef OS_NO_COND
+/** Number of condition variables created so far */
+static unsigned int Conds;
+#endif
+
+#ifndef OS_NO_BASIC
+/** Number of basic tasks created so far */
+static unsigned int Basics;
+
+/** The task that runs basic tasks, NULL until the first one exists */
+static PD *BasicTask = NULL;
+
+/** The priority of the job the runner is on; its own py is only the base */
+static PRIORITY BasicPy = MINPRIORITY;
+#endif
+
+#ifndef OS_NO_WORK
+/** Queued work items, highest priority first */
+static WORK *WorkQueue = NULL;
+
+/** The task that runs work items, NULL until the first Work_Init() */
+static PD *WorkTask = NULL;
+
+/** The priority of the item the worker is on; its own py is only the base */
+static PRIORITY WorkPy = MINPRIORITY;
+#endif
+
+/** Called from the idle loop before the CPU is put to sleep */
+static voidfuncptr IdleHook = NULL;
+
+/** Idle loop residency statistics */
+static unsigned long IdleTime = 0;
+static unsigned int IdleSleeps = 0;
+
+/** Set when a task that outranks Cp becomes READY, checked at kernel exit */
+static unsigned int Reschedule = 0;
+
+/** Number of dispatches that changed the running task */
+static unsigned long Switches = 0;
+
+#ifndef OS_NO_BUDGET
+/** Number of tasks with a CPU budget */
+static unsigned int Budgets = 0;
+#endif
+
+#ifndef OS_NO_MODE
+/** Number of entries in ModeTask[] */
+static unsigned int ModeTasks = 0;
+
+/** The mode set by the last Mode_Set() */
+static OPMODE CurrentMode = 0;
+#endif
+
 /** The ReadyQueue for tasks */
-volatile PD *ReadyQueue[MAXTHREAD];
-volatile int RQCount = 0;
+PD *ReadyQueue[MAXTHREAD];
+int RQCount = 0;
 
 /** The SleepQueue for tasks */
-volatile PD *SleepQueue[MAXTHREAD];
-volatile int SQCount = 0;
+PD *SleepQueue[MAXTHREAD];
+int SQCount = 0;
 
 /** The WaitingQueue for tasks */
-volatile PD *WaitingQueue[MAXTHREAD];
-volatile int WQCount = 0;
+PD *WaitingQueue[MAXTHREAD];
+int WQCount = 0;
+
+/** A task that is kept out of the ReadyQueue even when it is READY */
+#define PARKED(p)   ((p)->suspended || (p)->throttled || (p)->modeParked)
+
+/**
+  *  Make p READY. A suspended task is parked instead of queued, it goes
+  *  into the ReadyQueue when it is resumed. Every path that readies a task
+  *  comes through here, so this is where the need to preempt Cp is noted.
+  */
+static void Kernel_Ready_Task(PD *p) {
+	p->state = READY;
+
+	if (PARKED(p)) {
+		return;
+	}
+
+	enqueueRQ(&p, &ReadyQueue, &RQCount);
+
+	/** No current task means the kernel is idle and will pick p up itself */
+	if ((Cp != NULL) && (SCHED_PRIORITY(p) < SCHED_PRIORITY(Cp))) {
+		Reschedule = 1;
+	}
+}
 
 /**
  * Sets up a task's stack with Task_Terminate() at the bottom,
  * The return address of the function
  * and dummy data to be popped off when the task first runs
  */
-PID Kernel_Create_Task_At( volatile PD *p, voidfuncptr f, PRIORITY py, int arg ) {   
+PID Kernel_Create_Task_At( PD *p, voidfuncptr f, PRIORITY py, int arg ) {   
 	unsigned char *sp;
+	PINFO *info = &(ProcessInfo[p - Process]);
 
 #ifdef DEBUG
 	int counter = 0;
 #endif
 
-	sp = (unsigned char *) &(p->workSpace[WORKSPACE-1]);
+	sp = (unsigned char *) &(info->workSpace[info->workSpaceSize-1]);
 
-	//Clear the contents of the workspace
-	memset(&(p->workSpace),0,WORKSPACE);
+	//Paint the workspace so that Task_StackFree() can see how deep it got
+	memset(info->workSpace,STACK_PAINT,info->workSpaceSize);
 
 	//Notice that we are placing the address (16-bit) of the functions
 	//onto the stack in reverse byte order (least significant first, followed
@@ -151,26 +355,55 @@ PID Kernel_Create_Task_At( volatile PD *p, voidfuncptr f, PRIORITY py, int arg )
 		*(unsigned char *)sp-- = counter;
 	}
 #else
-	//Place stack pointer at top of stack
+	//Place stack pointer at top of stack, the initial registers are all 0
 	sp = sp - 34;
+	memset(sp + 1, 0, 34);
 #endif
+
+	//SREG, under EIND: the task starts with interrupts enabled, see Exit_Kernel
+	*(unsigned char *)(sp + 2) = 0x80;
 	  
 	p->sp = sp;     /* stack pointer into the "workSpace" */
-	p->code = f;        /* function to be executed as a task */
+	info->code = f;     /* function to be executed as a task */
 	p->request = NONE;
-	p->p = pCount;
 	p->py = py;
 	p->inheritedPy = py;
-	p->arg = arg;
+	p->threshold = MINPRIORITY;
+	info->arg = arg;
 	p->suspended = 0;
+	p->started = 0;
+	p->budgeted = 0;
+	p->throttled = 0;
+	p->demoted = 0;
+	p->leaving = 0;
+	p->modeParked = 0;
 	p->eWait = 99;
+	p->notify = 0;
+	p->notifyMask = 0;
+#ifndef OS_NO_NOTIFY
+	info->exitBits = 0;
+#endif
+#ifndef OS_NO_RWLOCK
+	info->readHeld = 0;
+#endif
+
+	/* configured tasks keep the PID os_static.h gave them */
+	if ((p - Process) >= STATIC_TASKS) {
+		p->p = (pCount << PID_SLOT_BITS) | (p - Process);
+
+		/* generation 0 is skipped, so that no PID is 0 */
+		if (++pCount == PID_GENERATIONS) {
+			pCount = 1;
+		}
+	}
 
 	Tasks++;
-	pCount++;
 
-	p->state = READY;
+	Kernel_Ready_Task(p);
 
-	enqueueRQ(&p, &ReadyQueue, &RQCount);
+#ifdef TRACE
+	Sim_TraceCreate(p->p, f);
+#endif
 
 	return p->p;
 }
@@ -183,61 +416,263 @@ static PID Kernel_Create_Task( voidfuncptr f, PRIORITY py, int arg ) {
 
 	if (Tasks == MAXTHREAD) return;  /* Too many task! */
 
-	/* find a DEAD PD that we can use  */
-	for (x = 0; x < MAXTHREAD; x++) {
+	/* find a DEAD PD that we can use, configured tasks keep their own slot */
+	for (x = STATIC_TASKS; x < MAXTHREAD; x++) {
 		if (Process[x].state == DEAD) break;
 	}
 
+	if (x >= MAXTHREAD) return 0;
+
 	unsigned int p = Kernel_Create_Task_At( &(Process[x]), f, py, arg );
 
 	return p;
 }
 
 /**
-  *  Suspend a task
+  *  Find the live task with PID p, NULL if there is none. The low bits of
+  *  a PID are its index in Process[], so this does not scan.
+  */
+static PD *Kernel_Lookup_Task(PID p) {
+	unsigned int x = p & ((1 << PID_SLOT_BITS) - 1);
+
+	if ((x >= MAXTHREAD) || (Process[x].p != p) || (Process[x].state == DEAD)) {
+		return NULL;
+	}
+
+	return &(Process[x]);
+}
+
+/**
+  *  Suspend a task. It is taken out of the ReadyQueue so that Dispatch()
+  *  never has to skip it; a sleeping or blocked task stays where it is and
+  *  is parked by Kernel_Ready_Task() when it wakes up.
   */
 static void Kernel_Suspend_Task() {
-	int i;
+	PD *p;
 
-	if(Cp->p == Cp->pidAction) {
+	if(Cp->p == Cp->args.pid) {
 		Cp->suspended = 1;
 	}
 	else {
-		for(i = 0; i < MAXTHREAD; i++) {
-			if (Process[i].p == Cp->pidAction) break;
-		}
+		p = Kernel_Lookup_Task(Cp->args.pid);
 
-		if(i >= MAXTHREAD) {
+		if(p == NULL) {
 			return;
 		}
 
-		Process[i].suspended = 1;
+		if (!p->suspended) {
+			p->suspended = 1;
+			removeQ(p, &ReadyQueue, &RQCount);
+		}
 	}
 }
 
 /**
   *  Resume a task
   */
-static unsigned int Kernel_Resume_Task() {
-	int i;
+static void Kernel_Resume_Task() {
+	PD *p = Kernel_Lookup_Task(Cp->args.pid);
+
+	if(p == NULL) {
+		return;
+	}
+
+	if(p->suspended == 1) {
+		p->suspended = 0;
+
+		/* a task that woke up while suspended was parked, queue it now */
+		if (p->state == READY) {
+			Kernel_Ready_Task(p);
+		}
+	}
+}
+
+/**
+  *  The priority p runs at: its own, or its job's for the basic task
+  *  runner and the worker, raised to that of the highest priority task
+  *  blocked on a mutex or a write hold that p owns
+  */
+static PRIORITY Kernel_Inherited_Priority(PD *p) {
+	PRIORITY py = p->py;
+	int i,j;
+
+#ifndef OS_NO_BASIC
+	if (p == BasicTask) {
+		py = BasicPy;
+	}
+#endif
+
+#ifndef OS_NO_WORK
+	if (p == WorkTask) {
+		py = WorkPy;
+	}
+#endif
+
+#ifndef OS_NO_MUTEX
+	for(i = 0; i < WQCount; i++) {
+		for(j = 0; j < MAXMUTEX; j++) {
+			if (Mutex[j].m == WaitingQueue[i]->args.m) break;
+		}
+
+		if ((j < MAXMUTEX) && (Mutex[j].owner == p->p) && (WaitingQueue[i]->inheritedPy < py)) {
+			py = WaitingQueue[i]->inheritedPy;
+		}
+	}
+#endif
 
+#ifndef OS_NO_RWLOCK
+	/* rwlock waiters are in no queue */
 	for(i = 0; i < MAXTHREAD; i++) {
-		if (Process[i].p == Cp->pidAction) break;
+		if ((Process[i].state == BLOCKED_ON_RWLOCK) && (Process[i].inheritedPy < py)) {
+			j = Process[i].args.rw.l;
+
+			if ((RwLock[j].state == RW_WRITE) && (RwLock[j].writer == p->p)) {
+				py = Process[i].inheritedPy;
+			}
+		}
 	}
+#endif
 
-	if(i >= MAXTHREAD) {
-			return 0;
+	return py;
+}
+
+/**
+  *  The task owning the mutex or write hold p is blocked on, NULL if none
+  */
+static PD *Kernel_Blocker(PD *p) {
+	int i;
+
+#ifndef OS_NO_MUTEX
+	if (p->state == BLOCKED_ON_MUTEX) {
+		for(i = 0; i < MAXMUTEX; i++) {
+			if (Mutex[i].m == p->args.m) {
+				return Kernel_Lookup_Task(Mutex[i].owner);
+			}
+		}
+	}
+#endif
+
+#ifndef OS_NO_RWLOCK
+	if ((p->state == BLOCKED_ON_RWLOCK) && (RwLock[p->args.rw.l].state == RW_WRITE)) {
+		return Kernel_Lookup_Task(RwLock[p->args.rw.l].writer);
+	}
+#endif
+
+	return NULL;
+}
+
+#if !defined(OS_NO_MODE) || !defined(OS_NO_BUDGET)
+/**
+  *  1 if p holds a mutex or a reader-writer lock
+  */
+static unsigned int Kernel_Holds_Lock(PD *p) {
+#ifndef OS_NO_MUTEX
+	int i;
+
+	for(i = 0; i < MAXMUTEX; i++) {
+		if ((Mutex[i].state == LOCKED) && (Mutex[i].owner == p->p)) {
+			return 1;
 		}
+	}
+#endif
 
-	if(Process[i].suspended == 1) {
-		Process[i].suspended = 0;
-		if(Process[i].inheritedPy < Cp->inheritedPy) {
+#ifndef OS_NO_RWLOCK
+	int j;
+
+	if (ProcessInfo[p - Process].readHeld != 0) {
+		return 1;
+	}
+
+	for(j = 0; j < MAXRWLOCK; j++) {
+		if ((RwLock[j].state == RW_WRITE) && (RwLock[j].writer == p->p)) {
 			return 1;
 		}
 	}
+#endif
 
 	return 0;
 }
+#endif
+
+/**
+  *  Put p in its place after its priority or threshold changed. A queued
+  *  task moves within the ReadyQueue; waiters keep theirs, the WaitingQueue
+  *  is first come first served and an event has a single waiter.
+  */
+static void Kernel_Requeue_Task(PD *p) {
+	if ((p != Cp) && (p->state == READY) && removeQ(p, &ReadyQueue, &RQCount)) {
+		Kernel_Ready_Task(p);
+	}
+
+	/* a lowered Cp gives way to a task that now outranks it */
+	if ((p == Cp) && (RQCount > 0) && (SCHED_PRIORITY(ReadyQueue[RQCount-1]) < SCHED_PRIORITY(Cp))) {
+		Reschedule = 1;
+	}
+}
+
+/**
+  *  Make p run at priority py
+  */
+static void Kernel_Move_Task(PD *p, PRIORITY py) {
+	if (p->inheritedPy == py) {
+		return;
+	}
+
+	p->inheritedPy = py;
+	Kernel_Requeue_Task(p);
+}
+
+/**
+  *  Raise p to py if that is higher, and with it every task down the chain
+  *  p is blocked on, e.g. C when p waits on B and B waits on C. A
+  *  deadlocked cycle is walked at most once round.
+  */
+static void Kernel_Boost_Task(PD *p, PRIORITY py) {
+	int i;
+
+	for (i = 0; (i < MAXTHREAD) && (p != NULL) && (p->inheritedPy > py); i++) {
+		Kernel_Move_Task(p, py);
+		p = Kernel_Blocker(p);
+	}
+}
+
+/**
+  *  Change the base priority of a task. Its inherited priority is worked
+  *  out again, and so is that of every task down the chain it is blocked
+  *  on, e.g. B which p waits on and C which B waits on. A deadlocked cycle
+  *  is walked at most once round.
+  */
+static void Kernel_Set_Priority() {
+	PD *p = Kernel_Lookup_Task(Cp->args.priority.pid);
+	PD *blocker;
+	int i;
+
+	if(p == NULL) {
+		return;
+	}
+
+	p->py = Cp->args.priority.py;
+	Kernel_Move_Task(p, Kernel_Inherited_Priority(p));
+
+	for (i = 0; (i < MAXTHREAD) && ((blocker = Kernel_Blocker(p)) != NULL); i++) {
+		Kernel_Move_Task(blocker, Kernel_Inherited_Priority(blocker));
+		p = blocker;
+	}
+}
+
+/**
+  *  Change the preemption threshold of a task
+  */
+static void Kernel_Set_Threshold() {
+	PD *p = Kernel_Lookup_Task(Cp->args.priority.pid);
+
+	if(p == NULL) {
+		return;
+	}
+
+	p->threshold = Cp->args.priority.py;
+	Kernel_Requeue_Task(p);
+}
 
 /**
   *  Terminate a task
@@ -247,14 +682,63 @@ static void Kernel_Terminate_Task() {
 	Cp->py = 0;
 	Cp->state = TERMINATED;
 
+#ifndef OS_NO_MUTEX
 	int i;
 
 	for(i = 0; i < MAXMUTEX; i++) {
 		if (Mutex[i].owner == Cp->p) {
-			Cp->m = Mutex[i].m;
+			Cp->args.m = Mutex[i].m;
 			Kernel_Unlock_Mutex();
 		}
 	}
+#endif
+
+#ifndef OS_NO_RWLOCK
+	int j;
+
+	for(j = 0; j < MAXRWLOCK; j++) {
+		if (((RwLock[j].state == RW_WRITE) && (RwLock[j].writer == Cp->p)) ||
+		    (ProcessInfo[Cp - Process].readHeld & (1 << j))) {
+			Cp->args.rw.l = RwLock[j].l;
+			Kernel_Unlock_RwLock();
+		}
+	}
+#endif
+
+#ifndef OS_NO_JOIN
+	int k;
+
+	/* joiners are in no queue unless they gave a timeout */
+	for(k = 0; k < MAXTHREAD; k++) {
+		if ((Process[k].state == WAITING_ON_JOIN) && (Process[k].args.sleep.join == Cp->p)) {
+			if (Process[k].request == JOIN_WAIT_TIMEOUT) {
+				removeQ(&(Process[k]), &SleepQueue, &SQCount);
+			}
+			Process[k].response = 1;
+			Kernel_Ready_Task(&(Process[k]));
+		}
+	}
+#endif
+
+#ifndef OS_NO_NOTIFY
+	PINFO *info = &(ProcessInfo[Cp - Process]);
+	PD *watcher;
+
+	if (info->exitBits) {
+		watcher = Kernel_Lookup_Task(info->exitWatcher);
+		if (watcher != NULL) {
+			Kernel_Notify(watcher, info->exitBits, NOTIFY_SET_BITS);
+		}
+		info->exitBits = 0;
+	}
+#endif
+
+#ifndef OS_NO_BUDGET
+	if (Cp->budgeted) {
+		Cp->budgeted = 0;
+		Budgets--;
+	}
+#endif
 
 	Cp->state = DEAD;
 	Cp->eWait = 99;
@@ -264,6 +748,7 @@ static void Kernel_Terminate_Task() {
 	Tasks--;
 }
 
+#ifndef OS_NO_MUTEX
 /**
   *  Initialize a mutex
   */
@@ -293,12 +778,27 @@ static MUTEX Kernel_Init_Mutex() {
 	return m;
 }
 
+/**
+  *  The owner of m inherits the priority of a task it blocks
+  */
+static void Kernel_Boost_Owner(MTX *m, PRIORITY py) {
+	int j;
+
+	for(j = 0; j < MAXTHREAD; j++) {
+		if ((Process[j].p == m->owner) && (Process[j].p != 0)) break;
+	}
+
+	if (j < MAXTHREAD) {
+		Kernel_Boost_Task(&(Process[j]), py);
+	}
+}
+
 /**
   *  Lock a mutex
   */
 static unsigned int Kernel_Lock_Mutex() {
 	int i,j;
-	MUTEX m = Cp->m;
+	MUTEX m = Cp->args.m;
 
 	for(i = 0; i < MAXMUTEX; i++) {
 		if (Mutex[i].m == m) break;
@@ -317,13 +817,7 @@ static unsigned int Kernel_Lock_Mutex() {
 		Mutex[i].lockCount++;
 	}
 	else {
-		for(j = 0; j < MAXTHREAD; j++) {
-			if ((Process[j].p == Mutex[i].owner) && (Process[j].p != 0)) break;
-		}
-
-		if (Process[j].inheritedPy > Cp->inheritedPy) {
-			Process[j].inheritedPy = Cp->inheritedPy;
-		}
+		Kernel_Boost_Owner(&(Mutex[i]), Cp->inheritedPy);
 
 		Cp->state = BLOCKED_ON_MUTEX;
 		enqueueWQ(&Cp, &WaitingQueue, &WQCount);
@@ -339,7 +833,7 @@ static unsigned int Kernel_Lock_Mutex() {
   */
 static void Kernel_Unlock_Mutex() {
 	int i;
-	MUTEX m = Cp->m;
+	MUTEX m = Cp->args.m;
 
 	for(i = 0; i < MAXMUTEX; i++) {
 		if (Mutex[i].m == m) break;
@@ -353,7 +847,7 @@ static void Kernel_Unlock_Mutex() {
 		return;
 	} 
 	else if (Cp->state == TERMINATED) {
-		volatile PD* p = dequeueWQ(&WaitingQueue, &WQCount, m);
+		PD* p = dequeueWQ(&WaitingQueue, &WQCount, m);
 		if (p == NULL) {
 			Mutex[i].lockCount = 0;
 			Mutex[i].state = FREE;
@@ -365,62 +859,344 @@ static void Kernel_Unlock_Mutex() {
 			Mutex[i].owner = p->p;
 
 			p->inheritedPy = Cp->inheritedPy;
-			p->state = READY;
 
 			Cp->inheritedPy = Cp->py;
 
 			Cp->state = READY;
 
-			enqueueRQ(&p, &ReadyQueue, &RQCount);
+			Kernel_Ready_Task(p);
 		}
 	}
 	else if (Mutex[i].lockCount > 1) {
 		Mutex[i].lockCount--;
 	}
 	else {
-		volatile PD* p = dequeueWQ(&WaitingQueue, &WQCount, m);
+		PD* p = dequeueWQ(&WaitingQueue, &WQCount, m);
 
 		if(p == NULL){
 			Mutex[i].state = FREE;
 			Mutex[i].lockCount = 0;
 			Mutex[i].owner = 0;
-			Cp->inheritedPy = Cp->py;
+
+			/* it keeps what it inherits through the other locks it holds */
+			Kernel_Move_Task(Cp, Kernel_Inherited_Priority(Cp));
 		}
 		else {
 			Mutex[i].lockCount = 1;
 			Mutex[i].owner = p->p;
 
 			p->inheritedPy = Cp->inheritedPy;
-			p->state = READY;
 
-			Cp->inheritedPy = Cp->py;
+			Kernel_Move_Task(Cp, Kernel_Inherited_Priority(Cp));
 
-			Cp->state = READY;
+			Kernel_Ready_Task(p);
 
-			enqueueRQ(&p, &ReadyQueue, &RQCount);
-			enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-			Dispatch();
+			/* the new owner runs before Cp even at equal priority,
+			   unless Cp's preemption threshold keeps it out */
+			if (!PARKED(p) && (SCHED_PRIORITY(p) <= SCHED_PRIORITY(Cp))) {
+				Reschedule = 1;
+			}
 		}
 	}
 }
+#endif /* OS_NO_MUTEX */
 
+#ifndef OS_NO_COND
 /**
-  *  Initialize an event
+  *  Initialize a condition variable
   */
-EVENT Kernel_Init_Event_At(volatile EVT *e) {
-	e->e = Events;
-	e->state = UNSIGNALLED;
-	e->p = NULL;
-
-	Events++;
+static COND Kernel_Init_Cond() {
+	if (Conds == MAXCOND) return MAXCOND;  // Too many condition variables!
 
-	return e->e;
+	return Conds++;
 }
 
 /**
-  *  Find an event to initialize
+  *  Release the mutex and wait on the condition, returns 0 if Cp does not
+  *  hold the mutex exactly once and so cannot wait
   */
-static EVENT Kernel_Init_Event() {
+static unsigned int Kernel_Wait_Cond() {
+	int i;
+	MUTEX m = Cp->args.cond.m;
+
+	if (Cp->args.cond.c >= Conds) {
+		return 0;
+	}
+
+	for(i = 0; i < MAXMUTEX; i++) {
+		if (Mutex[i].m == m) break;
+	}
+
+	if ((i >= MAXMUTEX) || (Mutex[i].owner != Cp->p) || (Mutex[i].lockCount != 1)) {
+		return 0;
+	}
+
+	/* args.cond.m is args.m, hand the mutex on as Mutex_Unlock() would */
+	Kernel_Unlock_Mutex();
+
+	Cp->state = WAITING_ON_COND;
+
+	return 1;
+}
+
+/**
+  *  A signalled waiter goes on to lock its mutex again, as if it had
+  *  called Mutex_Lock(), so the owner inherits its priority if it blocks
+  */
+static void Kernel_Relock_Cond(PD *p) {
+	int i;
+	MUTEX m = p->args.cond.m;
+
+	p->args.m = m;
+
+	for(i = 0; i < MAXMUTEX; i++) {
+		if (Mutex[i].m == m) break;
+	}
+
+	/* Kernel_Wait_Cond() checked m, but never index past the table */
+	if (i >= MAXMUTEX) {
+		Kernel_Ready_Task(p);
+		return;
+	}
+
+	if (Mutex[i].state == FREE) {
+		Mutex[i].state = LOCKED;
+		Mutex[i].owner = p->p;
+		Mutex[i].lockCount = 1;
+
+		Kernel_Ready_Task(p);
+	}
+	else {
+		Kernel_Boost_Owner(&(Mutex[i]), p->inheritedPy);
+
+		p->state = BLOCKED_ON_MUTEX;
+		enqueueWQ(&p, &WaitingQueue, &WQCount);
+	}
+}
+
+/**
+  *  Wake the highest priority waiter of a condition, or all of them
+  */
+static void Kernel_Signal_Cond(unsigned int all) {
+	int j;
+	PD *p;
+	COND c = Cp->args.cond.c;
+
+	do {
+		p = NULL;
+
+		for(j = 0; j < MAXTHREAD; j++) {
+			if ((Process[j].state == WAITING_ON_COND) && (Process[j].args.cond.c == c)) {
+				if ((p == NULL) || (Process[j].inheritedPy < p->inheritedPy)) {
+					p = &(Process[j]);
+				}
+			}
+		}
+
+		if (p != NULL) {
+			Kernel_Relock_Cond(p);
+		}
+	} while (all && (p != NULL));
+}
+#endif /* OS_NO_COND */
+
+#ifndef OS_NO_RWLOCK
+/**
+  *  Initialize a reader-writer lock
+  */
+static RWLOCK Kernel_Init_RwLock() {
+	int x;
+
+	for (x = 0; x < MAXRWLOCK; x++) {
+		if (RwLock[x].state == RW_DISABLED) break;
+	}
+
+	if (x >= MAXRWLOCK) return MAXRWLOCK;  // Too many locks!
+
+	RwLock[x].l = x;
+	RwLock[x].state = RW_FREE;
+	RwLock[x].readers = 0;
+	RwLock[x].readersWaiting = 0;
+	RwLock[x].writersWaiting = 0;
+	RwLock[x].writer = 0;
+
+	return x;
+}
+
+/**
+  *  The writer holding rw inherits the priority of a task it blocks
+  */
+static void Kernel_Boost_Writer(RWL *rw, PRIORITY py) {
+	int j;
+
+	if (rw->state != RW_WRITE) {
+		return;
+	}
+
+	for(j = 0; j < MAXTHREAD; j++) {
+		if ((Process[j].p == rw->writer) && (Process[j].state != DEAD)) break;
+	}
+
+	if (j < MAXTHREAD) {
+		Kernel_Boost_Task(&(Process[j]), py);
+	}
+}
+
+/**
+  *  Lock a reader-writer lock for reading or writing, returns 0 if Cp
+  *  has to wait
+  */
+static unsigned int Kernel_Lock_RwLock() {
+	RWL *rw;
+
+	if (Cp->args.rw.l >= MAXRWLOCK) {
+		return 1;
+	}
+
+	rw = &(RwLock[Cp->args.rw.l]);
+
+	if (rw->state == RW_DISABLED) {
+		return 1;
+	}
+
+	if (Cp->args.rw.write) {
+		if (rw->state == RW_FREE) {
+			rw->state = RW_WRITE;
+			rw->writer = Cp->p;
+			return 1;
+		}
+
+		rw->writersWaiting++;
+	}
+	else {
+		/* writer preference: readers queue up behind a waiting writer */
+		if ((rw->state != RW_WRITE) && (rw->writersWaiting == 0)) {
+			rw->state = RW_READ;
+			rw->readers++;
+			ProcessInfo[Cp - Process].readHeld |= (1 << rw->l);
+			return 1;
+		}
+
+		rw->readersWaiting++;
+	}
+
+	Kernel_Boost_Writer(rw, Cp->inheritedPy);
+
+	Cp->state = BLOCKED_ON_RWLOCK;
+
+	return 0;
+}
+
+/**
+  *  Hand a free lock to the highest priority waiting writer, or else to
+  *  all waiting readers at once
+  */
+static void Kernel_Grant_RwLock(RWL *rw) {
+	int j;
+	PD *p = NULL;
+
+	if (rw->writersWaiting > 0) {
+		for(j = 0; j < MAXTHREAD; j++) {
+			if ((Process[j].state == BLOCKED_ON_RWLOCK) && (Process[j].args.rw.l == rw->l) && Process[j].args.rw.write) {
+				if ((p == NULL) || (Process[j].inheritedPy < p->inheritedPy)) {
+					p = &(Process[j]);
+				}
+			}
+		}
+
+		/* the count is stale if its writers are gone, e.g. terminated */
+		if (p == NULL) {
+			rw->writersWaiting = 0;
+		}
+	}
+
+	if (p != NULL) {
+		rw->writersWaiting--;
+		rw->state = RW_WRITE;
+		rw->writer = p->p;
+
+		/* the new writer now blocks everybody still waiting */
+		for(j = 0; j < MAXTHREAD; j++) {
+			if ((Process[j].state == BLOCKED_ON_RWLOCK) && (Process[j].args.rw.l == rw->l)) {
+				Kernel_Boost_Writer(rw, Process[j].inheritedPy);
+			}
+		}
+
+		Kernel_Ready_Task(p);
+	}
+	else if (rw->readersWaiting > 0) {
+		rw->state = RW_READ;
+
+		for(j = 0; j < MAXTHREAD; j++) {
+			if ((Process[j].state == BLOCKED_ON_RWLOCK) && (Process[j].args.rw.l == rw->l)) {
+				rw->readers++;
+				ProcessInfo[j].readHeld |= (1 << rw->l);
+				Kernel_Ready_Task(&(Process[j]));
+			}
+		}
+
+		rw->readersWaiting = 0;
+	}
+}
+
+/**
+  *  Release a read or write hold on a reader-writer lock
+  */
+static void Kernel_Unlock_RwLock() {
+	RWL *rw;
+
+	if (Cp->args.rw.l >= MAXRWLOCK) {
+		return;
+	}
+
+	rw = &(RwLock[Cp->args.rw.l]);
+
+	if (rw->state == RW_READ) {
+		/* only a reader can let go of a read hold */
+		if (!(ProcessInfo[Cp - Process].readHeld & (1 << rw->l))) {
+			return;
+		}
+
+		ProcessInfo[Cp - Process].readHeld &= ~(1 << rw->l);
+
+		if (--(rw->readers) > 0) {
+			return;
+		}
+	}
+	else if ((rw->state == RW_WRITE) && (rw->writer == Cp->p)) {
+		rw->writer = 0;
+
+		/* it keeps what it inherits through the other locks it holds */
+		Kernel_Move_Task(Cp, Kernel_Inherited_Priority(Cp));
+	}
+	else {
+		return;
+	}
+
+	rw->state = RW_FREE;
+
+	Kernel_Grant_RwLock(rw);
+}
+#endif /* OS_NO_RWLOCK */
+
+#ifndef OS_NO_EVENT
+/**
+  *  Initialize an event
+  */
+EVENT Kernel_Init_Event_At(volatile EVT *e) {
+	e->e = Events;
+	e->state = UNSIGNALLED;
+	e->p = NULL;
+
+	Events++;
+
+	return e->e;
+}
+
+/**
+  *  Find an event to initialize
+  */
+static EVENT Kernel_Init_Event() {
 	int x;
 
 	if (Events == MAXEVENT) return; // Too many mutexes!
@@ -440,7 +1216,7 @@ static EVENT Kernel_Init_Event() {
   */
 static unsigned int Kernel_Wait_Event() {
 	int i;
-	unsigned int e = Cp->eSend;
+	EVENT e = Cp->args.e;
 
 	for (i = 0; i < MAXEVENT; i++) {
 		if (Event[i].e == e) break;
@@ -470,7 +1246,7 @@ static unsigned int Kernel_Wait_Event() {
   */
 static void Kernel_Signal_Event() {
 	int i, j;
-	unsigned int e = Cp->eSend;
+	EVENT e = Cp->args.e;
 
 	for (i = 0; i < MAXEVENT; i++) {
 		if (Event[i].e == e) break;
@@ -488,258 +1264,1811 @@ static void Kernel_Signal_Event() {
 		Event[i].state = SIGNALLED;
 	}
 	else {
-		Process[j].state = READY;
 		Process[j].eWait = 99;
 
 		Event[i].p = NULL;
 
-		if ((Process[j].inheritedPy < Cp->inheritedPy) && (Process[j].suspended == 0)) {
-			Cp->state = READY;
-			enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-			Dispatch();
-		}
+		Kernel_Ready_Task(&(Process[j]));
 	}
 }
+#endif /* OS_NO_EVENT */
 
+#ifndef OS_NO_NOTIFY
 /**
-  * This internal kernel function is the "scheduler". It chooses the 
-  * next task to run, i.e., Cp.
+  *  Update the notification bits of p and wake it if it waits for one of
+  *  them. Called with interrupts disabled from a task or an ISR, the
+  *  switch to p (if it outranks Cp) is left to the caller.
   */
-static void Dispatch() {
-	Cp = dequeueRQ(&ReadyQueue, &RQCount);
-
-	if (Cp == NULL) {
-		OS_Abort();
+static void Kernel_Notify(PD *p, NOTIFY bits, unsigned char action) {
+	switch(action) {
+	case NOTIFY_INCREMENT:
+		p->notify++;
+		break;
+	case NOTIFY_OVERWRITE:
+		p->notify = bits;
+		break;
+	default:
+		p->notify |= bits;
+		break;
 	}
 
-	CurrentSp = Cp->sp;
-	Cp->state = RUNNING;
+	if ((p->state == WAITING_ON_NOTIFY) && (p->notify & p->notifyMask)) {
+		/* only a wait with a timeout put p in the SleepQueue */
+		if (p->request == NOTIFY_WAIT_TIMEOUT) {
+			removeQ(p, &SleepQueue, &SQCount);
+		}
+		Kernel_Ready_Task(p);
+	}
 }
+#endif /* OS_NO_NOTIFY */
 
 /**
-  * This internal kernel function is the "main" driving loop of this full-served
-  * model architecture. Basically, on OS_Start(), the kernel repeatedly
-  * requests the next user task's next system call and then invokes the
-  * corresponding kernel function on its behalf.
-  *
-  * This is the main loop of our kernel, called by OS_Start().
+  *  True once tick count "when" has been reached. Tick counts wrap, so
+  *  this is only valid for times less than half the range apart.
   */
-static void Next_Kernel_Request() {
-	Dispatch();  /* select a new task to run */
+static unsigned int Kernel_Tick_Reached(TICK when) {
+	return (int)(tickCount - when) >= 0;
+}
 
-	unsigned int mutex_is_locked;
-	unsigned int resumed;
-	unsigned int waiting;
+#ifndef OS_NO_TIMER
 
-	while(1) {
-		Cp->request = NONE; /* clear its request */
+/**
+  *  Find the earliest expiry of all active timers and arm TimerTask for it
+  */
+static void Kernel_Arm_Timers() {
+	int i;
 
-		/* activate this newly selected task */
-		CurrentSp = Cp->sp;
+	TimerArmed = 0;
 
-		Exit_Kernel();    /* or CSwitch() */
+	for (i = 0; i < MAXTIMER; i++) {
+		if (Timer[i].state != ACTIVE) continue;
 
-		/* if this task makes a system call, it will return to here! */
+		if (!TimerArmed || ((int)(Timer[i].expiry - TimerNextExpiry) < 0)) {
+			TimerNextExpiry = Timer[i].expiry;
+			TimerArmed = 1;
+		}
+	}
+}
 
-		/* save the Cp's stack pointer */
-		Cp->sp = CurrentSp;
+/**
+  *  Runs the callbacks of all expired timers, one batch per wakeup.
+  *  This is the body of the timer task.
+  */
+static void Timer_Task() {
+	int i;
+	TMR *t;
+	CRITICAL_STATE sreg;
 
-		switch(Cp->request){
-		case CREATE:
-			Cp->response = Kernel_Create_Task( Cp->code, Cp->py, Cp->arg );
-			break;
-		case NEXT:
-		case NONE:
-			Cp->state = READY;
-			enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-			Dispatch();
-			break;
-		case SLEEP:
-			Cp->state = SLEEPING;
-			enqueueSQ(&Cp, &SleepQueue, &SQCount);
-			Dispatch();
-			break;
-		case SUSPEND:
-			Kernel_Suspend_Task();
-			if(Cp->suspended) {
-				Cp->state = READY;
-				enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-				Dispatch();
-			}
-			break;
-		case RESUME:
-			resumed = Kernel_Resume_Task();
-			if(resumed){
-				Cp->state = READY;
-				enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-				Dispatch();
+	for(;;) {
+		sreg = OS_CriticalEnter();
+		Cp->request = TIMER_WAIT;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+
+		for (i = 0; i < MAXTIMER; i++) {
+			t = &(Timer[i]);
+
+			sreg = OS_CriticalEnter();
+			if ((t->state == ACTIVE) && Kernel_Tick_Reached(t->expiry)) {
+				if ((t->mode == PERIODIC) && (t->period > 0)) {
+					t->expiry += t->period;
+				}
+				else {
+					t->state = STOPPED;
+				}
+				OS_CriticalExit(sreg);
+
+				t->f(t->arg);
 			}
-			break;
-		case TERMINATE:
-			/* deallocate all resources used by this task */
-			Kernel_Terminate_Task();
-			Dispatch();
-			break;
-		case MUTEX_INIT:
-			Cp->response = Kernel_Init_Mutex();
-			break;
-		case MUTEX_LOCK:
-			mutex_is_locked = Kernel_Lock_Mutex();
-			if (!mutex_is_locked) {
-				Dispatch();
+			else {
+				OS_CriticalExit(sreg);
 			}
-			break;
-		case MUTEX_UNLOCK:
-			Kernel_Unlock_Mutex();
-            break;
-        case EVENT_INIT:
-        	Cp->response = Kernel_Init_Event();
-        	break;
-        case EVENT_WAIT:
-        	waiting = Kernel_Wait_Event();
-        	if (waiting) {
-				Cp->state = WAITING_ON_EVENT;
-        		enqueueRQ(&Cp, &ReadyQueue, &RQCount);
-        		Dispatch();
-        	}
-        	break;
-        case EVENT_SIGNAL:
-        	Kernel_Signal_Event();
-        	break;
-		default:
-			/* Houston! we have a problem! */
-			break;
 		}
-	} 
+	}
+}
+
+/**
+  *  Initialize a timer, creating the timer task along with the first one
+  */
+static TIMER Kernel_Create_Timer() {
+	int x;
+	PID p;
+	unsigned int tasks = Tasks;
+
+	if (Timers == MAXTIMER) return MAXTIMER; // Too many timers!
+
+	if (TimerTask == NULL) {
+		p = Kernel_Create_Task( Timer_Task, TIMERPRIORITY, 0 );
+
+		if (Tasks == tasks) return MAXTIMER; // No room for the timer task!
+
+		for (x = 0; x < MAXTHREAD; x++) {
+			if ((Process[x].p == p) && (Process[x].state != DEAD)) break;
+		}
+
+		TimerTask = &(Process[x]);
+	}
+
+	for (x = 0; x < MAXTIMER; x++) {
+		if (Timer[x].state == UNUSED) break;
+	}
+
+	Timer[x].t = x;
+	Timer[x].state = STOPPED;
+	Timer[x].f = Cp->args.timerCreate.f;
+	Timer[x].arg = Cp->args.timerCreate.arg;
+	Timer[x].period = Cp->args.timerCreate.period;
+	Timer[x].mode = Cp->args.timerCreate.mode;
+
+	Timers++;
+
+	return Timer[x].t;
+}
+
+/**
+  *  Start, stop or reload a timer
+  */
+static void Kernel_Set_Timer() {
+	TIMER t = Cp->args.timer.t;
+
+	if ((t >= MAXTIMER) || (Timer[t].state == UNUSED)) {
+		return;
+	}
+
+	switch(Cp->request) {
+	case TIMER_RELOAD:
+		Timer[t].period = Cp->args.timer.period;
+		/* fall through, reloading restarts the timer */
+	case TIMER_START:
+		Timer[t].expiry = tickCount + Timer[t].period;
+		Timer[t].state = ACTIVE;
+		break;
+	case TIMER_STOP:
+		Timer[t].state = STOPPED;
+		break;
+	default:
+		break;
+	}
+
+	Kernel_Arm_Timers();
+}
+
+/**
+  *  Block the timer task until the next expiry, unless one is already due
+  */
+static unsigned int Kernel_Wait_Timer() {
+	Kernel_Arm_Timers();
+
+	if (TimerArmed && Kernel_Tick_Reached(TimerNextExpiry)) {
+		return 0;
+	}
+
+	return 1;
+}
+#endif /* OS_NO_TIMER */
+
+#ifndef OS_NO_BASIC
+/**
+  *  Queue one run of b. An idle runner is woken at b's priority; a busy
+  *  one finishes its current job at b's priority if that is higher, so b
+  *  waits for at most one job. Called with interrupts disabled, from a
+  *  task or an ISR.
+  */
+static void Kernel_Activate_Basic(BSC *b) {
+	if (b->pending < 0xFF) {
+		b->pending++;
+	}
+
+	if (BasicTask->state == WAITING_ON_BASIC) {
+		BasicPy = b->py;
+		BasicTask->inheritedPy = b->py;
+		Kernel_Ready_Task(BasicTask);
+	}
+	else if (b->py < BasicPy) {
+		BasicPy = b->py;
+
+		if (b->py < BasicTask->inheritedPy) {
+			Kernel_Move_Task(BasicTask, b->py);
+		}
+	}
+}
+
+/**
+  *  Runs pending basic tasks, highest priority first, one at a time on
+  *  this task's stack. This is the body of the basic task runner.
+  */
+static void Basic_Task() {
+	CRITICAL_STATE sreg;
+
+	for(;;) {
+		sreg = OS_CriticalEnter();
+		Cp->request = BASIC_WAIT;
+		Cp->response = MAXBASIC;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+
+		/* after a wait it asks again, more jobs may have come in */
+		if (Cp->response < MAXBASIC) {
+			Basic[Cp->response].f();
+		}
+	}
+}
+
+/**
+  *  Initialize a basic task, creating the runner along with the first one
+  */
+static BASIC Kernel_Create_Basic() {
+	int x;
+	PID p;
+	unsigned int tasks = Tasks;
+
+	if (Basics == MAXBASIC) return MAXBASIC; // Too many basic tasks!
+
+	if (BasicTask == NULL) {
+		p = Kernel_Create_Task( Basic_Task, Cp->args.basicCreate.py, 0 );
+
+		if (Tasks == tasks) return MAXBASIC; // No room for the runner!
+
+		BasicTask = Kernel_Lookup_Task(p);
+	}
+
+	for (x = 0; x < MAXBASIC; x++) {
+		if (!Basic[x].used) break;
+	}
+
+	Basic[x].b = x;
+	Basic[x].used = 1;
+	Basic[x].py = Cp->args.basicCreate.py;
+	Basic[x].pending = 0;
+	Basic[x].f = Cp->args.basicCreate.f;
+	Basic[x].period = Cp->args.basicCreate.period;
+	Basic[x].release = tickCount + Basic[x].period;
+
+	Basics++;
+
+	return Basic[x].b;
+}
+
+/**
+  *  Give the runner the highest priority pending job, in Cp->response, and
+  *  run it at that job's priority. Returns 1 if there is none.
+  */
+static unsigned int Kernel_Wait_Basic() {
+	int i;
+	BSC *next = NULL;
+
+	for (i = 0; i < MAXBASIC; i++) {
+		if (Basic[i].used && Basic[i].pending && ((next == NULL) || (Basic[i].py < next->py))) {
+			next = &(Basic[i]);
+		}
+	}
+
+	if (next == NULL) {
+		return 1;
+	}
+
+	next->pending--;
+	Cp->response = next->b;
+	BasicPy = next->py;
+	Kernel_Move_Task(Cp, next->py);
+
+	return 0;
+}
+#endif /* OS_NO_BASIC */
+
+#ifndef OS_NO_WORK
+/**
+  *  Queue w behind every item of its priority or higher. An idle worker is
+  *  woken at w's priority; a busy one finishes its current item at w's
+  *  priority if that is higher. Called with interrupts disabled, from a
+  *  task or an ISR. Returns 0 if w is already queued.
+  */
+static unsigned int Kernel_Submit_Work(WORK *w) {
+	WORK **link = &WorkQueue;
+
+	if (w->queued || (WorkTask == NULL)) {
+		return 0;
+	}
+
+	while ((*link != NULL) && ((*link)->py <= w->py)) {
+		link = &((*link)->next);
+	}
+
+	w->next = *link;
+	*link = w;
+	w->queued = 1;
+
+	if (WorkTask->state == WAITING_ON_WORK) {
+		WorkPy = w->py;
+		WorkTask->inheritedPy = w->py;
+		Kernel_Ready_Task(WorkTask);
+	}
+	else if (w->py < WorkPy) {
+		WorkPy = w->py;
+
+		if (w->py < WorkTask->inheritedPy) {
+			Kernel_Move_Task(WorkTask, w->py);
+		}
+	}
+
+	return 1;
+}
+
+/**
+  *  Runs queued work items, highest priority first, one at a time on this
+  *  task's stack. This is the body of the worker task.
+  */
+static void Work_Task() {
+	CRITICAL_STATE sreg;
+
+	for(;;) {
+		sreg = OS_CriticalEnter();
+		Cp->request = WORK_WAIT;
+		Cp->args.work.f = NULL;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+
+		/* after a wait it asks again, more work may have come in */
+		if (Cp->args.work.f != NULL) {
+			Cp->args.work.f(Cp->args.work.arg);
+		}
+	}
+}
+
+/**
+  *  Initialize a work item, creating the worker along with the first one
+  */
+static void Kernel_Init_Work() {
+	WORK *w = Cp->args.workInit.w;
+	PID p;
+	unsigned int tasks = Tasks;
+
+	if (WorkTask == NULL) {
+		p = Kernel_Create_Task( Work_Task, Cp->args.workInit.py, 0 );
+
+		if (Tasks == tasks) return; // No room for the worker!
+
+		WorkTask = Kernel_Lookup_Task(p);
+	}
+
+	w->next = NULL;
+	w->f = Cp->args.workInit.f;
+	w->arg = Cp->args.workInit.arg;
+	w->py = Cp->args.workInit.py;
+	w->queued = 0;
+}
+
+/**
+  *  Give the worker the first queued item, in Cp->args.work, and run it at
+  *  that item's priority. The item can be queued again as soon as it is
+  *  taken. Returns 1 if there is none.
+  */
+static unsigned int Kernel_Wait_Work() {
+	WORK *w = WorkQueue;
+
+	if (w == NULL) {
+		return 1;
+	}
+
+	WorkQueue = w->next;
+	w->queued = 0;
+
+	Cp->args.work.f = w->f;
+	Cp->args.work.arg = w->arg;
+	WorkPy = w->py;
+	Kernel_Move_Task(Cp, w->py);
+
+	return 0;
+}
+#endif /* OS_NO_WORK */
+
+/**
+  *  Sets up the sleep fields of p to wake t ticks from now. Called with
+  *  interrupts disabled, from the kernel or from a system call stub.
+  */
+static void Kernel_Set_Wake(PD *p, TICK t) {
+	unsigned int clockTicks = TCNT3/625;
+
+	p->args.sleep.wakeTickOverflow = tickOverflowCount + ((t + clockTicks) / 100);
+	p->args.sleep.wakeTick = (t + clockTicks) % 100;
+}
+
+#ifndef OS_NO_PERIOD
+/**
+  *  Make Cp periodic, its first release is now
+  */
+static void Kernel_Set_Period() {
+	PINFO *info = &(ProcessInfo[Cp - Process]);
+
+	info->period = Cp->args.period.period;
+	info->deadline = Cp->args.period.deadline ? Cp->args.period.deadline : info->period;
+	info->policy = Cp->args.period.policy;
+	info->release = tickCount;
+
+	memset(&(info->stats),0,sizeof(PERIOD_STATS));
+}
+
+/**
+  *  Cp finished the work of its current period. Counts a missed deadline
+  *  and applies the overrun policy. Returns 1 if Cp has to wait for its
+  *  next release, 0 if that has already passed.
+  */
+static unsigned int Kernel_Wait_Period() {
+	PINFO *info = &(ProcessInfo[Cp - Process]);
+	TICK now = tickCount;
+
+	Cp->response = 0;
+
+	if (info->period == 0) {
+		return 0;
+	}
+
+	info->stats.releases++;
+
+	if ((int)(now - (info->release + info->deadline)) > 0) {
+		info->stats.deadlineMisses++;
+		Cp->response = 1;
+	}
+
+	info->release += info->period;
+
+	if (info->policy == OVERRUN_SKIP) {
+		while ((int)(now - info->release) >= 0) {
+			info->release += info->period;
+			info->stats.skippedReleases++;
+		}
+	}
+
+	if ((int)(now - info->release) >= 0) {
+		return 0;
+	}
+
+	return 1;
+}
+#endif /* OS_NO_PERIOD */
+
+#ifndef OS_NO_MODE
+/**
+  *  Give p its settings for the new mode and release it if it was parked.
+  *  A new period counts from the next release.
+  */
+static void Kernel_Enter_Mode(PD *p, MODE_TASK *entry) {
+#ifndef OS_NO_PERIOD
+	PINFO *info = &(ProcessInfo[p - Process]);
+
+	if ((entry->period != 0) && (info->period != 0)) {
+		if (info->deadline == info->period) {
+			info->deadline = entry->period;
+		}
+		info->period = entry->period;
+	}
+#endif
+
+	p->leaving = 0;
+	p->py = entry->py;
+	Kernel_Move_Task(p, Kernel_Inherited_Priority(p));
+
+	/* a task the application suspended stays suspended */
+	if (p->modeParked) {
+		p->modeParked = 0;
+
+		if (p->state == READY) {
+#ifndef OS_NO_PERIOD
+			/* the releases it slept through while parked are not owed */
+			info->release = tickCount;
+#endif
+			Kernel_Ready_Task(p);
+		}
+	}
+}
+
+/**
+  *  Park p, which has no place in the new mode. A task that is between two
+  *  jobs, i.e. in Task_WaitPeriod() or Mode_Boundary() and not dispatched
+  *  since, and holds no lock is parked at once. Any other task is parked
+  *  at its next boundary, see Kernel_Mode_Boundary().
+  */
+static void Kernel_Leave_Mode(PD *p) {
+	if (p->modeParked) {
+		return;
+	}
+
+	/* the request is cleared when a task is dispatched */
+	if ((p != Cp) && ((p->request == PERIOD_WAIT) || (p->request == MODE_BOUNDARY)) &&
+	    ((p->state == WAITING_ON_PERIOD) || (p->state == READY)) && !Kernel_Holds_Lock(p)) {
+		p->modeParked = 1;
+		removeQ(p, &ReadyQueue, &RQCount);
+	}
+	else {
+		p->leaving = 1;
+	}
+}
+
+/**
+  *  Switch every task declared for any mode to its settings in mode m, all
+  *  in one kernel request. Tasks without an entry for m are parked.
+  */
+static void Kernel_Set_Mode() {
+	OPMODE m = Cp->args.mode;
+	MODE_TASK *entry;
+	unsigned int managed;
+	PD *p;
+	unsigned int i,j;
+
+	for (i = 0; i < MAXTHREAD; i++) {
+		p = &(Process[i]);
+
+		if (p->state == DEAD) continue;
+
+		managed = 0;
+		entry = NULL;
+
+		for (j = 0; j < ModeTasks; j++) {
+			if (ModeTask[j].p == p->p) {
+				managed = 1;
+
+				if (ModeTask[j].mode == m) {
+					entry = &(ModeTask[j]);
+				}
+			}
+		}
+
+		if (!managed) continue;
+
+		if (entry != NULL) {
+			Kernel_Enter_Mode(p, entry);
+		}
+		else {
+			Kernel_Leave_Mode(p);
+		}
+	}
+
+	CurrentMode = m;
+}
+
+/**
+  *  Cp finished a job, in Task_WaitPeriod() or Mode_Boundary(). If it is
+  *  leaving the mode it is parked here, unless it still holds a lock; it
+  *  would block every other user of the lock for the whole mode. So a
+  *  periodic task leaves within one job, a task that blocks elsewhere only
+  *  once it gets to its boundary.
+  */
+static void Kernel_Mode_Boundary() {
+	if (Cp->leaving && !Kernel_Holds_Lock(Cp)) {
+		Cp->leaving = 0;
+		Cp->modeParked = 1;
+	}
+}
+#endif /* OS_NO_MODE */
+
+/**
+  * Returns the time since setup() in units of CLOCKUS, built from the
+  * per-second overflow count and Timer3. Called with interrupts disabled.
+  */
+static unsigned long Kernel_Clock() {
+	unsigned long overflows = tickOverflowCount;
+	unsigned int count = TCNT3;
+
+	/** A compare match that has not been serviced yet belongs to this reading */
+	if ((TIFR3 & (1 << OCF3A)) && (count < (OCR3A / 2))) {
+		overflows++;
+	}
+
+	return overflows * (OCR3A + 1) + count;
+}
+
+#ifndef OS_NO_BUDGET
+/**
+  *  Charge p for the CPU time since it was dispatched or last charged.
+  *  Once its budget is used up it is throttled or demoted, and if it is Cp
+  *  it gives up the CPU at the next reschedule point. A task is not
+  *  throttled while it holds a lock, its waiters would wait for the next
+  *  replenishment; the unlock charges it again.
+  */
+static void Kernel_Charge_Budget(PD *p) {
+	PINFO *info = &(ProcessInfo[p - Process]);
+	unsigned long now = Kernel_Clock();
+	unsigned int queued;
+
+	info->used += now - info->dispatched;
+	info->dispatched = now;
+
+	if ((info->used < info->budget) || p->throttled || p->demoted) {
+		return;
+	}
+
+	if ((info->budgetPolicy == BUDGET_THROTTLE) && Kernel_Holds_Lock(p)) {
+		return;
+	}
+
+	info->overruns++;
+
+	/* Dispatch() charges a task that may already be queued again */
+	queued = removeQ(p, &ReadyQueue, &RQCount);
+
+	if (info->budgetPolicy == BUDGET_DEMOTE) {
+		p->demoted = 1;
+
+		if (queued) {
+			Kernel_Ready_Task(p);
+		}
+	}
+	else {
+		p->throttled = 1;
+	}
+
+	if (p == Cp) {
+		Reschedule = 1;
+	}
+}
+
+/**
+  *  Lift the throttling or demotion of a task whose budget is refilled
+  */
+static void Kernel_Restore_Budget(PD *p) {
+	if (p->throttled) {
+		p->throttled = 0;
+
+		/* a task that ran out while READY was parked, queue it now */
+		if ((p->state == READY) && (p != Cp)) {
+			Kernel_Ready_Task(p);
+		}
+	}
+
+	if (p->demoted) {
+		p->demoted = 0;
+		Kernel_Requeue_Task(p);
+	}
+}
+
+/**
+  *  Refill the budget of every task whose period has come round. Unused
+  *  budget is kept until then, but never carried over, i.e. a budgeted
+  *  task is a deferrable server.
+  */
+static void Kernel_Replenish_Budgets() {
+	int i;
+	PD *p;
+	PINFO *info;
+
+	for (i = 0; i < MAXTHREAD; i++) {
+		p = &(Process[i]);
+		info = &(ProcessInfo[i]);
+
+		if (!p->budgeted || !Kernel_Tick_Reached(info->replenish)) {
+			continue;
+		}
+
+		info->replenish += info->budgetPeriod;
+		info->used = 0;
+
+		Kernel_Restore_Budget(p);
+	}
+}
+
+/**
+  *  Give a task a CPU budget per period, or take it away with period 0
+  */
+static void Kernel_Set_Budget() {
+	PD *p = Kernel_Lookup_Task(Cp->args.budget.pid);
+	PINFO *info;
+
+	if (p == NULL) {
+		return;
+	}
+
+	info = &(ProcessInfo[p - Process]);
+
+	if (Cp->args.budget.period == 0) {
+		if (p->budgeted) {
+			p->budgeted = 0;
+			Budgets--;
+		}
+	}
+	else {
+		if (!p->budgeted) {
+			p->budgeted = 1;
+			Budgets++;
+		}
+
+		info->budget = Cp->args.budget.budget;
+		info->budgetPeriod = Cp->args.budget.period;
+		info->budgetPolicy = Cp->args.budget.policy;
+		info->replenish = tickCount + info->budgetPeriod;
+		info->used = 0;
+		info->overruns = 0;
+		info->dispatched = Kernel_Clock();
+	}
+
+	/* a fresh or lifted budget always lets the task run again */
+	Kernel_Restore_Budget(p);
+}
+#endif /* OS_NO_BUDGET */
+
+/**
+  * The kernel idle loop, entered from Dispatch() when no task is ready.
+  * There is no current task while idle, so instead of a task with its own
+  * stack the kernel sleeps on its own stack until an interrupt readies one.
+  */
+static void Kernel_Idle() {
+	unsigned long start;
+
+	if (IdleHook != NULL) {
+		Enable_Interrupt();
+		IdleHook();
+		Disable_Interrupt();
+
+		/* an ISR during the hook readied a task, Dispatch() picks it up */
+		if (RQCount > 0) {
+			return;
+		}
+	}
+
+	start = Kernel_Clock();
+
+	set_sleep_mode(IDLE_SLEEP_MODE);
+	sleep_enable();
+	Enable_Interrupt();
+	sleep_cpu();        /** sei always lets the next instruction run first, so no wakeup is lost */
+	sleep_disable();
+	Disable_Interrupt();
+
+	IdleTime += Kernel_Clock() - start;
+	IdleSleeps++;
+}
+
+/**
+  * This internal kernel function is the "scheduler". It chooses the 
+  * next task to run, i.e., Cp. If nothing is ready the kernel idles
+  * until an interrupt makes a task ready.
+  */
+static void Dispatch() {
+	PD *last = Cp;
+
+	/* a task that stopped by itself is ranked at its priority again */
+	if ((last != NULL) && (last->state != READY)) {
+		last->started = 0;
+	}
+
+#ifndef OS_NO_BUDGET
+	if ((last != NULL) && last->budgeted) {
+		Kernel_Charge_Budget(last);
+	}
+#endif
+
+	while ((Cp = dequeueRQ(&ReadyQueue, &RQCount)) == NULL) {
+		Kernel_Idle();
+	}
+
+	if (Cp != last) {
+		Switches++;
+	}
+
+#ifndef OS_NO_BUDGET
+	if (Cp->budgeted) {
+		ProcessInfo[Cp - Process].dispatched = Kernel_Clock();
+	}
+#endif
+
+	CurrentSp = Cp->sp;
+	Cp->state = RUNNING;
+	Cp->started = 1;
+
+	/* nothing READY outranks the task just picked */
+	Reschedule = 0;
+
+#ifdef TRACE
+	Sim_TraceDispatch(Cp->p);
+#endif
+}
+
+/**
+  * This internal kernel function is the "main" driving loop of this full-served
+  * model architecture. Basically, on OS_Start(), the kernel repeatedly
+  * requests the next user task's next system call and then invokes the
+  * corresponding kernel function on its behalf.
+  *
+  * This is the main loop of our kernel, called by OS_Start().
+  */
+static void Next_Kernel_Request() {
+	Dispatch();  /* select a new task to run */
+
+	unsigned int mutex_is_locked;
+	unsigned int waiting;
+
+	while(1) {
+		Cp->request = NONE; /* clear its request */
+
+		/* activate this newly selected task */
+		CurrentSp = Cp->sp;
+
+		Exit_Kernel();    /* or CSwitch() */
+
+		/* if this task makes a system call, it will return to here! */
+
+		/* save the Cp's stack pointer */
+		Cp->sp = CurrentSp;
+
+		switch(Cp->request){
+		case CREATE:
+			Cp->response = Kernel_Create_Task( Cp->args.create.code, Cp->args.create.py, Cp->args.create.arg );
+			break;
+		case NEXT:
+		case NONE:
+			/* a yield ends the run, a preemption from an ISR does not */
+			if (!Reschedule) {
+				Cp->started = 0;
+			}
+			Kernel_Ready_Task(Cp);
+			Dispatch();
+			break;
+		case SLEEP:
+			Cp->state = SLEEPING;
+			enqueueSQ(&Cp, &SleepQueue, &SQCount);
+			Dispatch();
+			break;
+		case SUSPEND:
+			Kernel_Suspend_Task();
+			if(Cp->suspended) {
+				Kernel_Ready_Task(Cp);
+				Dispatch();
+			}
+			break;
+		case RESUME:
+			Kernel_Resume_Task();
+			break;
+		case SET_PRIORITY:
+			Kernel_Set_Priority();
+			break;
+		case SET_THRESHOLD:
+			Kernel_Set_Threshold();
+			break;
+#ifndef OS_NO_BUDGET
+		case SET_BUDGET:
+			Kernel_Set_Budget();
+			break;
+#endif
+#ifndef OS_NO_MODE
+		case MODE_SET:
+			Kernel_Set_Mode();
+			break;
+		case MODE_BOUNDARY:
+			Kernel_Mode_Boundary();
+			if (Cp->modeParked) {
+				Kernel_Ready_Task(Cp);
+				Dispatch();
+			}
+			break;
+#endif
+		case TERMINATE:
+			/* deallocate all resources used by this task */
+			Kernel_Terminate_Task();
+			Dispatch();
+			break;
+#ifndef OS_NO_MUTEX
+		case MUTEX_INIT:
+			Cp->response = Kernel_Init_Mutex();
+			break;
+		case MUTEX_LOCK:
+			mutex_is_locked = Kernel_Lock_Mutex();
+			if (!mutex_is_locked) {
+				Dispatch();
+			}
+			break;
+		case MUTEX_UNLOCK:
+			Kernel_Unlock_Mutex();
+#ifndef OS_NO_BUDGET
+			/* a holder that overran is throttled once it lets go */
+			if (Cp->budgeted) {
+				Kernel_Charge_Budget(Cp);
+			}
+#endif
+            break;
+		case MUTEX_UNLOCK_SLEEP:
+			Kernel_Unlock_Mutex();
+			Kernel_Set_Wake(Cp, Cp->args.unlockSleep.t);
+			Cp->state = SLEEPING;
+			enqueueSQ(&Cp, &SleepQueue, &SQCount);
+			Dispatch();
+			break;
+#endif
+#if !defined(OS_NO_MUTEX) && !defined(OS_NO_EVENT)
+		case MUTEX_UNLOCK_WAIT:
+			Kernel_Unlock_Mutex();
+			Cp->args.e = Cp->args.unlockWait.wait;
+			if (Kernel_Wait_Event()) {
+				Cp->state = WAITING_ON_EVENT;
+				Dispatch();
+			}
+			break;
+#endif
+#ifndef OS_NO_COND
+		case COND_INIT:
+			Cp->response = Kernel_Init_Cond();
+			break;
+		case COND_WAIT:
+			if (Kernel_Wait_Cond()) {
+				/* not in any queue, Kernel_Signal_Cond() moves it on to the mutex */
+				Dispatch();
+			}
+			break;
+		case COND_SIGNAL:
+			Kernel_Signal_Cond(0);
+			break;
+		case COND_BROADCAST:
+			Kernel_Signal_Cond(1);
+			break;
+#endif
+#ifndef OS_NO_RWLOCK
+		case RWLOCK_INIT:
+			Cp->response = Kernel_Init_RwLock();
+			break;
+		case RWLOCK_LOCK:
+			if (!Kernel_Lock_RwLock()) {
+				/* not in any queue, Kernel_Grant_RwLock() readies it */
+				Dispatch();
+			}
+			break;
+		case RWLOCK_UNLOCK:
+			Kernel_Unlock_RwLock();
+#ifndef OS_NO_BUDGET
+			if (Cp->budgeted) {
+				Kernel_Charge_Budget(Cp);
+			}
+#endif
+			break;
+#endif
+#ifndef OS_NO_EVENT
+        case EVENT_INIT:
+        	Cp->response = Kernel_Init_Event();
+        	break;
+        case EVENT_WAIT:
+        	waiting = Kernel_Wait_Event();
+        	if (waiting) {
+				/* not in any queue, Kernel_Signal_Event() readies it */
+				Cp->state = WAITING_ON_EVENT;
+        		Dispatch();
+        	}
+        	break;
+        case EVENT_SIGNAL:
+        	Kernel_Signal_Event();
+        	break;
+		case EVENT_SIGNAL_WAIT:
+			Kernel_Signal_Event();
+			Cp->args.e = Cp->args.signalWait.wait;
+			if (Kernel_Wait_Event()) {
+				Cp->state = WAITING_ON_EVENT;
+				Dispatch();
+			}
+			break;
+#endif
+#ifndef OS_NO_NOTIFY
+		case NOTIFY_WAIT:
+			/* not in any queue, Kernel_Notify() readies it */
+			Cp->state = WAITING_ON_NOTIFY;
+			Dispatch();
+			break;
+		case NOTIFY_WAIT_TIMEOUT:
+			/* the tick ISR readies it if no notification comes first */
+			Cp->state = WAITING_ON_NOTIFY;
+			enqueueSQ(&Cp, &SleepQueue, &SQCount);
+			Dispatch();
+			break;
+#endif
+#ifndef OS_NO_BASIC
+		case BASIC_CREATE:
+			Cp->response = Kernel_Create_Basic();
+			break;
+		case BASIC_WAIT:
+			if (Kernel_Wait_Basic()) {
+				/* not in any queue, Kernel_Activate_Basic() readies it */
+				Cp->state = WAITING_ON_BASIC;
+				Dispatch();
+			}
+			break;
+#endif
+#ifndef OS_NO_WORK
+		case WORK_INIT:
+			Kernel_Init_Work();
+			break;
+		case WORK_WAIT:
+			if (Kernel_Wait_Work()) {
+				/* not in any queue, Kernel_Submit_Work() readies it */
+				Cp->state = WAITING_ON_WORK;
+				Dispatch();
+			}
+			break;
+#endif
+#ifndef OS_NO_JOIN
+		case JOIN_WAIT:
+			/* not in any queue, Kernel_Terminate_Task() readies it */
+			Cp->state = WAITING_ON_JOIN;
+			Dispatch();
+			break;
+		case JOIN_WAIT_TIMEOUT:
+			/* the tick ISR readies it, with response still 0, on timeout */
+			Cp->state = WAITING_ON_JOIN;
+			enqueueSQ(&Cp, &SleepQueue, &SQCount);
+			Dispatch();
+			break;
+#endif
+#ifndef OS_NO_TIMER
+		case TIMER_CREATE:
+			Cp->response = Kernel_Create_Timer();
+			break;
+		case TIMER_START:
+		case TIMER_STOP:
+		case TIMER_RELOAD:
+			Kernel_Set_Timer();
+			break;
+		case TIMER_WAIT:
+			waiting = Kernel_Wait_Timer();
+			if (waiting) {
+				/* not in any queue, the tick ISR readies it */
+				Cp->state = WAITING_ON_TIMER;
+				Dispatch();
+			}
+			break;
+#endif
+#ifndef OS_NO_PERIOD
+		case PERIOD_SET:
+			Kernel_Set_Period();
+			break;
+		case PERIOD_WAIT:
+			waiting = Kernel_Wait_Period();
+#ifndef OS_NO_MODE
+			Kernel_Mode_Boundary();
+#endif
+			if (waiting) {
+				Cp->state = WAITING_ON_PERIOD;
+				Dispatch();
+			}
+#ifndef OS_NO_MODE
+			else if (Cp->modeParked) {
+				/* parked by the mode change while its next release is due */
+				Kernel_Ready_Task(Cp);
+				Dispatch();
+			}
+#endif
+			break;
+#endif
+		default:
+			/* Houston! we have a problem! */
+			break;
+		}
+
+		/* the one reschedule point: a request that readied a task
+		   outranking Cp switches to it before leaving the kernel */
+		if (Reschedule) {
+			/* a throttled Cp is parked rather than queued */
+			Kernel_Ready_Task(Cp);
+			Dispatch();
+		}
+	} 
+}
+
+/*================
+  * RTOS  API  and Stubs
+  *================
+  */
+
+/**
+  * This function initializes the RTOS and must be called first
+  */
+void OS_Init() {
+	int x;
+
+	Tasks = 0;
+	KernelActive = 0;
+	Mutexes = STATIC_MUTEXES;
+	Events = STATIC_EVENTS;
+	pCount = 1;
+
+	/* Configured tasks are already in the table and only need a stack frame */
+	for (x = 0; x < STATIC_TASKS; x++) {
+		Kernel_Create_Task_At( &(Process[x]), ProcessInfo[x].code, Process[x].py, ProcessInfo[x].arg );
+	}
+
+	for (x = STATIC_TASKS; x < MAXTHREAD; x++) {
+		memset(&(Process[x]),0,sizeof(PD));
+		Process[x].state = DEAD;
+		Process[x].eWait = 99;
+		Process[x].p = 0;
+		ProcessInfo[x].workSpace = WorkSpace[x - STATIC_TASKS];
+		ProcessInfo[x].workSpaceSize = WORKSPACE;
+	}
+
+#ifndef OS_NO_MUTEX
+	for (x = STATIC_MUTEXES; x < MAXMUTEX; x++) {
+		memset(&(Mutex[x]),0,sizeof(MTX));
+		Mutex[x].state = DISABLED;
+	}
+#endif
+
+#ifndef OS_NO_EVENT
+	for (x = STATIC_EVENTS; x < MAXEVENT; x++) {
+		memset(&(Event[x]),0,sizeof(EVT));
+		Event[x].state = INACTIVE;
+	}
+#endif
+}
+
+/**
+  * This function starts the RTOS after creating a_main
+  */
+void OS_Start() {   
+	if ( (! KernelActive) && (Tasks > 0)) {
+		Disable_Interrupt();
+
+		KernelActive = 1;
+		Next_Kernel_Request();
+		/* SHOULD NEVER GET HERE!!! */
+	}
+}
+
+/**
+  * Just quits
+  */
+void OS_Abort() {
+	exit(1);
+}
+
+/**
+  * Sets the function the kernel calls each time it is about to idle
+  */
+void OS_SetIdleHook(voidfuncptr hook) {
+	IdleHook = hook;
+}
+
+/**
+  * Copies the idle loop statistics
+  */
+void OS_IdleStats(IDLE_STATS *s) {
+	CRITICAL_STATE sreg;
+
+	sreg = OS_CriticalEnter();
+	s->idleTime = IdleTime;
+	s->upTime = Kernel_Clock();
+	s->sleeps = IdleSleeps;
+	s->switches = Switches;
+	OS_CriticalExit(sreg);
+}
+
+/**
+  * Returns the number of bytes at the far end of a stack that were never
+  * written, i.e. by how much the stack could shrink
+  */
+static unsigned int Kernel_Stack_Free(unsigned char *stack, unsigned int size) {
+	unsigned int i;
+
+	for (i = 0; (i < size) && (stack[i] == STACK_PAINT); i++);
+
+	return i;
+}
+
+/**
+  * Returns how many bytes of p's workspace have never been used
+  */
+unsigned int Task_StackFree(PID p) {
+	CRITICAL_STATE sreg;
+	unsigned int free = 0;
+	int i;
+
+	sreg = OS_CriticalEnter();
+
+	for (i = 0; i < MAXTHREAD; i++) {
+		if ((Process[i].p == p) && (Process[i].state != DEAD)) {
+			free = Kernel_Stack_Free(ProcessInfo[i].workSpace, ProcessInfo[i].workSpaceSize);
+			break;
+		}
+	}
+
+	OS_CriticalExit(sreg);
+
+	return free;
+}
+
+/**
+  * Returns how many bytes of the interrupt stack have never been used
+  */
+unsigned int OS_IsrStackFree() {
+	return Kernel_Stack_Free(IsrStack, ISRSTACK);
+}
+
+/**
+  * Returns the number of CPU cycles since setup(). Timer5 counts every
+  * cycle and its overflows extend it to 32 bits. Safe to call from tasks,
+  * ISRs and the kernel.
+  */
+unsigned long OS_Cycles() {
+	CRITICAL_STATE sreg;
+	unsigned int low;
+	unsigned int high;
+
+	sreg = OS_CriticalEnter();
+
+	low = TCNT5;
+	high = cycleOverflowCount;
+
+	/** An overflow that has not been serviced yet belongs to this reading */
+	if ((TIFR5 & (1 << TOV5)) && (low < 0x8000)) {
+		high++;
+	}
+
+	OS_CriticalExit(sreg);
+
+	return ((unsigned long)high << 16) | low;
+}
+
+/**
+  * Returns the number of microseconds since setup()
+  */
+unsigned long OS_TimeUs() {
+	return OS_Cycles() / CYCLESPERUS;
+}
+
+#ifndef OS_NO_MUTEX
+/**
+  * Application level mutex init to setup system call
+  */
+MUTEX Mutex_Init() {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MUTEX_INIT;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
+	}
+}
+
+/**
+  * Application level mutex lock to setup system call
+  */
+void Mutex_Lock(MUTEX m) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MUTEX_LOCK;
+		Cp->args.m = m;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+	
+}
+
+/**
+  * Application level mutex unlock to setup system call
+  */
+void Mutex_Unlock(MUTEX m) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MUTEX_UNLOCK;
+		Cp->args.m = m;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level mutex unlock and task sleep, in one system call
+  */
+void Mutex_UnlockAndSleep(MUTEX m, TICK t) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MUTEX_UNLOCK_SLEEP;
+		Cp->args.unlockSleep.m = m;
+		Cp->args.unlockSleep.t = t;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+#ifndef OS_NO_EVENT
+/**
+  * Application level mutex unlock and event wait, in one system call. A
+  * task that takes m and signals e cannot get in between the two.
+  */
+void Mutex_UnlockAndWait(MUTEX m, EVENT e) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MUTEX_UNLOCK_WAIT;
+		Cp->args.unlockWait.m = m;
+		Cp->args.unlockWait.wait = e;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+#endif
+
+#endif /* OS_NO_MUTEX */
+
+#ifndef OS_NO_NOTIFY
+/**
+  * Application level task notify. It updates the target directly, the
+  * kernel is only entered to switch to a target that outranks the caller.
+  */
+void Task_Notify(PID p, NOTIFY bits, NOTIFY_ACTION action) {
+	CRITICAL_STATE sreg;
+	PD *pd;
+
+	if(KernelActive) {
+		sreg = OS_CriticalEnter();
+
+		pd = Kernel_Lookup_Task(p);
+		if (pd != NULL) {
+			Kernel_Notify(pd, bits, action);
+		}
+
+		if (Reschedule) {
+			Cp->request = NEXT;
+			Enter_Kernel();
+		}
+
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level task notify wait. Returns the pending bits in mask
+  * and clears them, waiting up to timeout ticks for one to be set.
+  */
+NOTIFY Task_NotifyWait(NOTIFY mask, TICK timeout) {
+	CRITICAL_STATE sreg;
+	NOTIFY bits = 0;
+
+	if(KernelActive) {
+		sreg = OS_CriticalEnter();
+
+		if (((Cp->notify & mask) == 0) && (timeout != NOTIFY_NO_WAIT)) {
+			Cp->notifyMask = mask;
+
+			if (timeout == NOTIFY_FOREVER) {
+				Cp->request = NOTIFY_WAIT;
+			}
+			else {
+				Cp->request = NOTIFY_WAIT_TIMEOUT;
+				Kernel_Set_Wake(Cp, timeout);
+			}
+
+			Enter_Kernel();
+		}
+
+		bits = Cp->notify & mask;
+		Cp->notify &= ~mask;
+
+		OS_CriticalExit(sreg);
+	}
+
+	return bits;
+}
+
+/**
+  * Task notify for ISRs, the ISR must end with OS_IsrExit()
+  */
+void Task_NotifyFromISR(PID p, NOTIFY bits, NOTIFY_ACTION action) {
+	PD *pd = Kernel_Lookup_Task(p);
+
+	if (pd != NULL) {
+		Kernel_Notify(pd, bits, action);
+	}
+}
+
+/**
+  * Application level exit notification. When p terminates the caller's
+  * notification bits are or-ed with bits; if p is already gone they are
+  * set at once. A task has one watcher, the last caller wins.
+  */
+void Task_NotifyOnExit(PID p, NOTIFY bits) {
+	CRITICAL_STATE sreg;
+	PD *pd;
+
+	if(KernelActive) {
+		sreg = OS_CriticalEnter();
+
+		pd = Kernel_Lookup_Task(p);
+		if (pd == NULL) {
+			Kernel_Notify(Cp, bits, NOTIFY_SET_BITS);
+		}
+		else {
+			ProcessInfo[pd - Process].exitWatcher = Cp->p;
+			ProcessInfo[pd - Process].exitBits = bits;
+		}
+
+		OS_CriticalExit(sreg);
+	}
+}
+#endif /* OS_NO_NOTIFY */
+
+/**
+  * Ends an ISR: if it readied a task that outranks the interrupted one,
+  * switch to it. This saves the task's context, so it has to be called on
+  * the task's own stack, i.e. not from a handler run by OS_IsrCall().
+  */
+void OS_IsrExit() {
+	if (Reschedule && (Cp != NULL) && (IsrNesting == 0)) {
+		Task_Next();
+	}
+}
+
+#ifndef OS_NO_COND
+/**
+  * Application level condition init to setup system call
+  */
+COND Cond_Init() {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = COND_INIT;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
+	}
+}
+
+/**
+  * Application level condition wait to setup system call. Returns with
+  * m locked again, callers re-check their predicate in a loop.
+  */
+void Cond_Wait(COND c, MUTEX m) {
+	if(KernelActive && (m < Mutexes)) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = COND_WAIT;
+		Cp->args.cond.m = m;
+		Cp->args.cond.c = c;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level condition signal to setup system call
+  */
+void Cond_Signal(COND c) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = COND_SIGNAL;
+		Cp->args.cond.c = c;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level condition broadcast to setup system call
+  */
+void Cond_Broadcast(COND c) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = COND_BROADCAST;
+		Cp->args.cond.c = c;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+#endif /* OS_NO_COND */
+
+#ifndef OS_NO_RWLOCK
+/**
+  * Application level reader-writer lock init to setup system call
+  */
+RWLOCK RwLock_Init() {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = RWLOCK_INIT;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
+	}
+}
+
+/**
+  * Takes or releases a hold through the kernel, for when it may block
+  * or wake another task
+  */
+static void RwLock_Request(KERNEL_REQUEST_TYPE request, RWLOCK l, unsigned char write) {
+	Cp->request = request;
+	Cp->args.rw.l = l;
+	Cp->args.rw.write = write;
+	Enter_Kernel();
+}
+
+/**
+  * Application level read lock. Only enters the kernel when a writer
+  * holds the lock or waits for it.
+  */
+void RwLock_ReadLock(RWLOCK l) {
+	RWL *rw = &(RwLock[l]);
+
+	if(KernelActive && (l < MAXRWLOCK)) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		if (((rw->state == RW_FREE) || (rw->state == RW_READ)) && (rw->writersWaiting == 0)) {
+			rw->state = RW_READ;
+			rw->readers++;
+			ProcessInfo[Cp - Process].readHeld |= (1 << l);
+		}
+		else {
+			RwLock_Request(RWLOCK_LOCK, l, 0);
+		}
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level read unlock. Only enters the kernel when the last
+  * reader leaves and somebody waits, or Cp holds no read lock to release.
+  */
+void RwLock_ReadUnlock(RWLOCK l) {
+	RWL *rw = &(RwLock[l]);
+
+	if(KernelActive && (l < MAXRWLOCK)) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		if ((rw->state == RW_READ) && (ProcessInfo[Cp - Process].readHeld & (1 << l)) &&
+		    ((rw->readers > 1) || (rw->writersWaiting == 0))) {
+			ProcessInfo[Cp - Process].readHeld &= ~(1 << l);
+
+			if (--(rw->readers) == 0) {
+				rw->state = RW_FREE;
+			}
+		}
+		else {
+			RwLock_Request(RWLOCK_UNLOCK, l, 0);
+		}
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level write lock. Only enters the kernel when the lock
+  * is held.
+  */
+void RwLock_WriteLock(RWLOCK l) {
+	RWL *rw = &(RwLock[l]);
+
+	if(KernelActive && (l < MAXRWLOCK)) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		if (rw->state == RW_FREE) {
+			rw->state = RW_WRITE;
+			rw->writer = Cp->p;
+		}
+		else {
+			RwLock_Request(RWLOCK_LOCK, l, 1);
+		}
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level write unlock. Only enters the kernel when somebody
+  * waits, i.e. the writer may have inherited a priority.
+  */
+void RwLock_WriteUnlock(RWLOCK l) {
+	RWL *rw = &(RwLock[l]);
+
+	if(KernelActive && (l < MAXRWLOCK)) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		if ((rw->state == RW_WRITE) && (rw->writer == Cp->p) && (rw->readersWaiting == 0) && (rw->writersWaiting == 0)) {
+			rw->state = RW_FREE;
+			rw->writer = 0;
+		}
+		else {
+			RwLock_Request(RWLOCK_UNLOCK, l, 1);
+		}
+		OS_CriticalExit(sreg);
+	}
+}
+#endif /* OS_NO_RWLOCK */
+
+#ifndef OS_NO_EVENT
+/**
+  * Application level event init to setup system call
+  */
+EVENT Event_Init() {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = EVENT_INIT;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
+	}
+}
+
+/**
+  * Application level event wait to setup system call
+  */
+void Event_Wait(EVENT e) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = EVENT_WAIT;
+		Cp->args.e = e;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
 }
 
-/*================
-  * RTOS  API  and Stubs
-  *================
+/**
+  * Application level event signal to setup system call
   */
+void Event_Signal(EVENT e) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = EVENT_SIGNAL;
+		Cp->args.e = e;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
 
 /**
-  * This function initializes the RTOS and must be called first
+  * Application level event signal and event wait, in one system call
   */
-void OS_Init() {
-	int x;
-
-	Tasks = 0;
-	KernelActive = 0;
-	Mutexes = 0;
-	Events = 0;
-	pCount = 0;
-
-	for (x = 0; x < MAXTHREAD; x++) {
-		memset(&(Process[x]),0,sizeof(PD));
-		Process[x].state = DEAD;
-		Process[x].eWait = 99;
-		Process[x].p = 0;
+void Event_SignalAndWait(EVENT signal, EVENT wait) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = EVENT_SIGNAL_WAIT;
+		Cp->args.signalWait.e = signal;
+		Cp->args.signalWait.wait = wait;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
+}
 
-	for (x = 0; x < MAXMUTEX; x++) {
-		memset(&(Mutex[x]),0,sizeof(MTX));
-		Mutex[x].state = DISABLED;
-	}
+#endif /* OS_NO_EVENT */
 
-	for (x = 0; x < MAXEVENT; x++) {
-		memset(&(Event[x]),0,sizeof(EVT));
-		Event[x].state = INACTIVE;
+#ifndef OS_NO_TIMER
+/**
+  * Application level timer create to setup system call
+  */
+TIMER Timer_Create(timerfuncptr f, int arg, TICK period, TIMER_MODE mode) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = TIMER_CREATE;
+		Cp->args.timerCreate.f = f;
+		Cp->args.timerCreate.arg = arg;
+		Cp->args.timerCreate.period = period;
+		Cp->args.timerCreate.mode = mode;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
 	}
 }
 
 /**
-  * This function starts the RTOS after creating a_main
+  * Application level timer start to setup system call
   */
-void OS_Start() {   
-	if ( (! KernelActive) && (Tasks > 0)) {
-		Disable_Interrupt();
-
-		KernelActive = 1;
-		Next_Kernel_Request();
-		/* SHOULD NEVER GET HERE!!! */
+void Timer_Start(TIMER t) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = TIMER_START;
+		Cp->args.timer.t = t;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
 }
 
 /**
-  * Just quits
+  * Application level timer stop to setup system call
   */
-void OS_Abort() {
-	exit(1);
+void Timer_Stop(TIMER t) {
+	if(KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = TIMER_STOP;
+		Cp->args.timer.t = t;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
 }
 
 /**
-  * Application level mutex init to setup system call
+  * Application level timer reload to setup system call
   */
-MUTEX Mutex_Init() {
+void Timer_Reload(TIMER t, TICK period) {
 	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = MUTEX_INIT;
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = TIMER_RELOAD;
+		Cp->args.timer.t = t;
+		Cp->args.timer.period = period;
 		Enter_Kernel();
-		return Cp->response;
+		OS_CriticalExit(sreg);
 	}
 }
+#endif /* OS_NO_TIMER */
 
+#ifndef OS_NO_BASIC
 /**
-  * Application level mutex lock to setup system call
+  * Application level basic task create to setup system call
   */
-void Mutex_Lock(MUTEX m) {
+BASIC Basic_Create(voidfuncptr f, PRIORITY py, TICK period) {
 	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = MUTEX_LOCK;
-		Cp->m = m;
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = BASIC_CREATE;
+		Cp->args.basicCreate.f = f;
+		Cp->args.basicCreate.py = py;
+		Cp->args.basicCreate.period = period;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		return Cp->response;
 	}
-	
 }
 
 /**
-  * Application level mutex unlock to setup system call
+  * Application level basic task activate. Like Task_Notify() it works on
+  * the tables directly and only enters the kernel to switch to the runner.
   */
-void Mutex_Unlock(MUTEX m) {
+void Basic_Activate(BASIC b) {
+	CRITICAL_STATE sreg;
+
 	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = MUTEX_UNLOCK;
-		Cp->m = m;
-		Enter_Kernel();
+		sreg = OS_CriticalEnter();
+
+		if ((b < MAXBASIC) && Basic[b].used) {
+			Kernel_Activate_Basic(&(Basic[b]));
+		}
+
+		if (Reschedule) {
+			Cp->request = NEXT;
+			Enter_Kernel();
+		}
+
+		OS_CriticalExit(sreg);
 	}
 }
 
 /**
-  * Application level event init to setup system call
+  * Basic task activate for ISRs, the ISR must end with OS_IsrExit()
   */
-EVENT Event_Init() {
-	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = EVENT_INIT;
-		Enter_Kernel();
-		return Cp->response;
+void Basic_ActivateFromISR(BASIC b) {
+	if ((b < MAXBASIC) && Basic[b].used) {
+		Kernel_Activate_Basic(&(Basic[b]));
 	}
 }
+#endif /* OS_NO_BASIC */
 
+#ifndef OS_NO_WORK
 /**
-  * Application level event wait to setup system call
+  * Application level work item initialize to setup system call
   */
-void Event_Wait(EVENT e) {
+void Work_Init(WORK *w, timerfuncptr f, int arg, PRIORITY py) {
 	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = EVENT_WAIT;
-		Cp->eSend = e;
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = WORK_INIT;
+		Cp->args.workInit.w = w;
+		Cp->args.workInit.f = f;
+		Cp->args.workInit.arg = arg;
+		Cp->args.workInit.py = py;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
 }
 
 /**
-  * Application level event signal to setup system call
+  * Application level work submit. Like Basic_Activate() it works on the
+  * queue directly and only enters the kernel to switch to the worker.
   */
-void Event_Signal(EVENT e) {
+unsigned int Work_Submit(WORK *w) {
+	CRITICAL_STATE sreg;
+	unsigned int queued = 0;
+
 	if(KernelActive) {
-		Disable_Interrupt();
-		Cp->request = EVENT_SIGNAL;
-		Cp->eSend = e;
-		Enter_Kernel();
+		sreg = OS_CriticalEnter();
+
+		queued = Kernel_Submit_Work(w);
+
+		if (Reschedule) {
+			Cp->request = NEXT;
+			Enter_Kernel();
+		}
+
+		OS_CriticalExit(sreg);
 	}
+
+	return queued;
+}
+
+/**
+  * Work submit for ISRs, the ISR must end with OS_IsrExit()
+  */
+unsigned int Work_SubmitFromISR(WORK *w) {
+	return Kernel_Submit_Work(w);
 }
+#endif /* OS_NO_WORK */
 
 /**
   * Application or kernel level task create to setup system call
@@ -748,12 +3077,13 @@ PID Task_Create( voidfuncptr f, PRIORITY py, int arg){
 	unsigned int p;
 
 	if (KernelActive) {
-		Disable_Interrupt();
+		CRITICAL_STATE sreg = OS_CriticalEnter();
 		Cp->request = CREATE;
-		Cp->code = f;
-		Cp->py = py;
-		Cp->arg = arg;
+		Cp->args.create.code = f;
+		Cp->args.create.py = py;
+		Cp->args.create.arg = arg;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
 		p = Cp->response;
 	} else { 
 	  /* call the RTOS function directly */
@@ -767,9 +3097,10 @@ PID Task_Create( voidfuncptr f, PRIORITY py, int arg){
   */
 void Task_Next() {
 	if (KernelActive) {
-		Disable_Interrupt();
+		CRITICAL_STATE sreg = OS_CriticalEnter();
 		Cp->request = NEXT;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
 }
 
@@ -778,24 +3109,89 @@ void Task_Next() {
   */
 void Task_Sleep(TICK t) {
 	if (KernelActive) {
-		Disable_Interrupt();
+		CRITICAL_STATE sreg = OS_CriticalEnter();
 		Cp->request = SLEEP;
-		unsigned int clockTicks = TCNT3/625;
-		Cp->wakeTickOverflow = tickOverflowCount + ((t + clockTicks) / 100);
-		Cp->wakeTick = (t + clockTicks) % 100;
+		Kernel_Set_Wake(Cp, t);
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+#ifndef OS_NO_PERIOD
+/**
+  * Application level task set period to setup system call
+  */
+void Task_SetPeriod(TICK period, TICK deadline, OVERRUN_POLICY policy, voidfuncptr hook) {
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = PERIOD_SET;
+		Cp->args.period.period = period;
+		Cp->args.period.deadline = deadline;
+		Cp->args.period.policy = policy;
+		ProcessInfo[Cp - Process].overrunHook = hook;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level task wait period to setup system call. The overrun
+  * hook runs here, in the task's own context, before the next period.
+  */
+unsigned int Task_WaitPeriod() {
+	unsigned int missed = 0;
+	PINFO *info;
+
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = PERIOD_WAIT;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
+		missed = Cp->response;
+
+		info = &(ProcessInfo[Cp - Process]);
+		if (missed && (info->policy == OVERRUN_HOOK) && (info->overrunHook != NULL)) {
+			info->overrunHook();
+		}
+	}
+
+	return missed;
+}
+
+/**
+  * Copies the timing statistics of periodic task p
+  */
+void Task_GetPeriodStats(PID p, PERIOD_STATS *s) {
+	CRITICAL_STATE sreg;
+	int i;
+
+	sreg = OS_CriticalEnter();
+
+	for (i = 0; i < MAXTHREAD; i++) {
+		if ((Process[i].p == p) && (Process[i].state != DEAD)) break;
+	}
+
+	if (i < MAXTHREAD) {
+		*s = ProcessInfo[i].stats;
 	}
+	else {
+		memset(s,0,sizeof(PERIOD_STATS));
+	}
+
+	OS_CriticalExit(sreg);
 }
+#endif /* OS_NO_PERIOD */
 
 /**
   * Application level task suspend to setup system call
   */
 void Task_Suspend(PID p) {
 	if (KernelActive) {
-		Disable_Interrupt();
+		CRITICAL_STATE sreg = OS_CriticalEnter();
 		Cp->request = SUSPEND;
-		Cp->pidAction = p;
+		Cp->args.pid = p;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
 }
 
@@ -804,13 +3200,161 @@ void Task_Suspend(PID p) {
   */
 void Task_Resume(PID p) {
 	if (KernelActive) {
-		Disable_Interrupt();
+		CRITICAL_STATE sreg = OS_CriticalEnter();
 		Cp->request = RESUME;
-		Cp->pidAction = p;
+		Cp->args.pid = p;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level task set priority to setup system call
+  */
+void Task_SetPriority(PID p, PRIORITY py) {
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = SET_PRIORITY;
+		Cp->args.priority.pid = p;
+		Cp->args.priority.py = py;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level task set threshold to setup system call
+  */
+void Task_SetThreshold(PID p, PRIORITY threshold) {
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = SET_THRESHOLD;
+		Cp->args.priority.pid = p;
+		Cp->args.priority.py = threshold;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+#ifndef OS_NO_BUDGET
+/**
+  * Application level task set budget to setup system call
+  */
+void Task_SetBudget(PID p, unsigned long budgetUs, TICK period, BUDGET_POLICY policy) {
+	if (budgetUs > MAXBUDGETUS) {
+		budgetUs = MAXBUDGETUS;  /* the kernel keeps it in 16 bits of CLOCKUS */
+	}
+
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = SET_BUDGET;
+		Cp->args.budget.pid = p;
+		Cp->args.budget.budget = budgetUs / CLOCKUS;
+		Cp->args.budget.period = period;
+		Cp->args.budget.policy = policy;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Makes p a deferrable server, it is stopped once its budget runs out
+  */
+void Task_SetServer(PID p, unsigned long budgetUs, TICK period) {
+	Task_SetBudget(p, budgetUs, period, BUDGET_THROTTLE);
+}
+
+/**
+  * Copies the CPU budget statistics of task p
+  */
+void Task_GetBudgetStats(PID p, BUDGET_STATS *s) {
+	CRITICAL_STATE sreg;
+	PD *pd;
+	PINFO *info;
+
+	sreg = OS_CriticalEnter();
+
+	pd = Kernel_Lookup_Task(p);
+
+	if ((pd != NULL) && pd->budgeted) {
+		info = &(ProcessInfo[pd - Process]);
+		s->budget = (unsigned long)info->budget * CLOCKUS;
+		s->used = info->used * CLOCKUS;
+		s->overruns = info->overruns;
+	}
+	else {
+		memset(s,0,sizeof(BUDGET_STATS));
+	}
+
+	OS_CriticalExit(sreg);
+}
+#endif /* OS_NO_BUDGET */
+
+#ifndef OS_NO_MODE
+/**
+  * Application level mode declaration. Only fills in the table, the
+  * settings are applied by the next Mode_Set().
+  */
+void Mode_Declare(PID p, OPMODE m, PRIORITY py, TICK period) {
+	CRITICAL_STATE sreg;
+	unsigned int i;
+
+	sreg = OS_CriticalEnter();
+
+	for (i = 0; i < ModeTasks; i++) {
+		if ((ModeTask[i].p == p) && (ModeTask[i].mode == m)) break;
+	}
+
+	if (i == ModeTasks) {
+		if (ModeTasks == MAXMODETASK) {
+			OS_CriticalExit(sreg);
+			return; // Too many mode entries!
+		}
+		ModeTasks++;
+	}
+
+	ModeTask[i].p = p;
+	ModeTask[i].mode = m;
+	ModeTask[i].py = py;
+	ModeTask[i].period = period;
+
+	OS_CriticalExit(sreg);
+}
+
+/**
+  * Application level mode change to setup system call
+  */
+void Mode_Set(OPMODE m) {
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MODE_SET;
+		Cp->args.mode = m;
+		Enter_Kernel();
+		OS_CriticalExit(sreg);
+	}
+}
+
+/**
+  * Application level job boundary. A task leaving the mode is parked here,
+  * tasks that are not periodic call it at the top of their loop.
+  */
+void Mode_Boundary() {
+	if (KernelActive) {
+		CRITICAL_STATE sreg = OS_CriticalEnter();
+		Cp->request = MODE_BOUNDARY;
 		Enter_Kernel();
+		OS_CriticalExit(sreg);
 	}
 }
 
+/**
+  * Returns the mode set by the last Mode_Set()
+  */
+OPMODE Mode_Get() {
+	return CurrentMode;
+}
+#endif /* OS_NO_MODE */
+
 /**
   * Application level task terminate to setup system call
   */
@@ -823,11 +3367,60 @@ void Task_Terminate() {
 	}
 }
 
+#ifndef OS_NO_JOIN
+/**
+  * Application level task join. Waits up to timeout ticks for p to
+  * terminate and returns 1 once it has, or at once if there is no such
+  * task (any more). A stale PID does not match a new task in its slot
+  * until PID_GENERATIONS - 1 (1023) more tasks have been created.
+  */
+unsigned int Task_Join(PID p, TICK timeout) {
+	CRITICAL_STATE sreg;
+	unsigned int joined = 1;
+
+	if(KernelActive) {
+		sreg = OS_CriticalEnter();
+
+		if (Kernel_Lookup_Task(p) != NULL) {
+			joined = 0;
+
+			/* a task cannot outlive itself */
+			if ((p != Cp->p) && (timeout != JOIN_NO_WAIT)) {
+				Cp->args.sleep.join = p;
+				Cp->response = 0;
+
+				if (timeout == JOIN_FOREVER) {
+					Cp->request = JOIN_WAIT;
+				}
+				else {
+					Cp->request = JOIN_WAIT_TIMEOUT;
+					Kernel_Set_Wake(Cp, timeout);
+				}
+
+				Enter_Kernel();
+				joined = Cp->response;
+			}
+		}
+
+		OS_CriticalExit(sreg);
+	}
+
+	return joined;
+}
+#endif /* OS_NO_JOIN */
+
 /**
   * Application level task getarg to return intiial arg value
   */
 int Task_GetArg(PID p) {
-	return (Cp->arg);
+	return (ProcessInfo[Cp - Process].arg);
+}
+
+/**
+  * Application level lookup of the calling task's own PID
+  */
+PID Task_GetPid() {
+	return Cp->p;
 }
 
 /**
@@ -838,6 +3431,9 @@ void setup() {
 	/** initialize Timer1 16 bit timer */
 	Disable_Interrupt();
 
+	/** Paint the interrupt stack before any ISR can use it, see OS_IsrStackFree() */
+	memset(IsrStack, STACK_PAINT, ISRSTACK);
+
 	/** Timer 1 */
 	TCCR1A = 0;                 /** Set TCCR1A register to 0 */
 	TCCR1B = 0;                 /** Set TCCR1B register to 0 */
@@ -853,44 +3449,97 @@ void setup() {
 	TIMSK1 |= (1 << OCIE1A);    /** Enable timer compare interrupt */
 
 	/** Timer 3 */
-	TCCR3A = 0;                 /** Set TCCR0A register to 0 */
-	TCCR3B = 0;                 /** Set TCCR0B register to 0 */
+	TCCR3A = 0;                 /** Set TCCR3A register to 0 */
+	TCCR3B = 0;                 /** Set TCCR3B register to 0 */
 
 	TCNT3 = 0;                  /** Initialize counter to 0 */
 
-	OCR3A = 62499;              /** Compare match register (TOP comparison value) [(16MHz/(100Hz*8)] - 1 */
+	OCR3A = 62499;              /** Compare match register (TOP comparison value) [16MHz/(256*1Hz)] - 1 */
 
-	TCCR3B |= (1 << WGM32);     /** Turns on CTC mode (TOP is now OCR1A) */
+	TCCR3B |= (1 << WGM32);     /** Turns on CTC mode (TOP is now OCR3A) */
 
-	TCCR3B |= (1 << CS32);      /** Prescaler 1024 */
+	TCCR3B |= (1 << CS32);      /** Prescaler 256, i.e. one count per CLOCKUS */
 
 	TIMSK3 = (1 << OCIE3A);
 
+	/** Timer 5, free running cycle counter for OS_Cycles() */
+	TCCR5A = 0;                 /** Normal mode, counts 0..0xFFFF */
+	TCCR5B = 0;
+
+	TCNT5 = 0;                  /** Initialize counter to 0 */
+
+	TIMSK5 = (1 << TOIE5);      /** Enable overflow interrupt */
+
+	TCCR5B |= (1 << CS50);      /** Prescaler 1 */
+
 	Enable_Interrupt();
 }
 
 /**
-  * ISR for timer1
+  * Tick handler, run on the interrupt stack
   */
-ISR(TIMER1_COMPA_vect) {
+static void Kernel_Tick() {
+	int i;
+	PD *p;
 
-	volatile int i;
+	tickCount += 1;
 
 	for (i = SQCount-1; i >= 0; i--) {
-		if ((SleepQueue[i]->wakeTickOverflow <= tickOverflowCount) && (SleepQueue[i]->wakeTick <= (TCNT3/625))) {
-			volatile PD *p = dequeue(&SleepQueue, &SQCount);
-			p->state = READY;
-			enqueueRQ(&p, &ReadyQueue, &RQCount);
-			if (p->inheritedPy < Cp->inheritedPy) {
-				Task_Next();
-			}
+		if ((SleepQueue[i]->args.sleep.wakeTickOverflow <= tickOverflowCount) && (SleepQueue[i]->args.sleep.wakeTick <= (TCNT3/625))) {
+			p = dequeue(&SleepQueue, &SQCount);
+			Kernel_Ready_Task(p);
 		}
 		else {
 			break;
 		}
 	}
 
-	// Task_Next();
+#ifndef OS_NO_PERIOD
+	/** Period waiters are in no queue, their releases are counted in ticks */
+	for (i = 0; i < MAXTHREAD; i++) {
+		if ((Process[i].state == WAITING_ON_PERIOD) && Kernel_Tick_Reached(ProcessInfo[i].release)) {
+			Kernel_Ready_Task(&(Process[i]));
+		}
+	}
+#endif
+
+#ifndef OS_NO_TIMER
+	/** One wakeup of the timer task handles every timer that is due */
+	if (TimerArmed && (TimerTask->state == WAITING_ON_TIMER) && Kernel_Tick_Reached(TimerNextExpiry)) {
+		TimerArmed = 0;
+		Kernel_Ready_Task(TimerTask);
+	}
+#endif
+
+#ifndef OS_NO_BUDGET
+	if (Budgets > 0) {
+		Kernel_Replenish_Budgets();
+
+		/* a task that ran through its budget is preempted by OS_IsrExit() */
+		if ((Cp != NULL) && Cp->budgeted) {
+			Kernel_Charge_Budget(Cp);
+		}
+	}
+#endif
+
+#ifndef OS_NO_BASIC
+	for (i = 0; i < MAXBASIC; i++) {
+		if (Basic[i].used && (Basic[i].period > 0) && Kernel_Tick_Reached(Basic[i].release)) {
+			Basic[i].release += Basic[i].period;
+			Kernel_Activate_Basic(&(Basic[i]));
+		}
+	}
+#endif
+}
+
+/**
+  * ISR for timer1
+  */
+ISR(TIMER1_COMPA_vect) {
+	OS_IsrCall(Kernel_Tick);
+
+	/** Switch once, after every task woken by this tick is queued */
+	OS_IsrExit();
 }
 
 /**
@@ -901,13 +3550,23 @@ ISR(TIMER3_COMPA_vect) {
 }
 
 /**
-  * This function boots the OS and creates the first task: a_main
+  * ISR for timer5
+  */
+ISR(TIMER5_OVF_vect) {
+	cycleOverflowCount += 1;
+}
+
+/**
+  * This function boots the OS and creates the first task: a_main,
+  * or with a static configuration starts the configured tasks
   */
 void main() {
 	setup();
 
 	OS_Init();
+#ifndef STATIC_CONFIG
 	Task_Create(a_main, 0, 1);
+#endif
 	OS_Start();
 }
 
@@ -1,29 +1,116 @@
 #ifndef _OS_H_
 #define _OS_H_
    
-#define MAXTHREAD     16
+#ifndef WORKSPACE
 #define WORKSPACE     256   /** in bytes, per THREAD */
+#endif
+#ifndef ISRSTACK
+#define ISRSTACK      128   /** in bytes, shared by all ISRs that use OS_IsrCall() */
+#endif
+#define STACK_PAINT   0xA5  /** fill byte of unused stack, see Task_StackFree() */
+#define PID_SLOT_BITS 6     /** low bits of a PID index Process[], so MAXTHREAD <= 64 */
+
+#ifdef STATIC_CONFIG
+#include "os_static.h"      /** tables sized from the application's os_config.h */
+#else
+#define MAXTHREAD     16
 #define MAXMUTEX      8
 #define MAXEVENT      8
+#endif
+
+#ifndef MAXTIMER
+#define MAXTIMER      8
+#endif
+#ifndef MAXRWLOCK
+#define MAXRWLOCK     4
+#endif
+#if MAXRWLOCK > 8
+#error "read holds are kept in one bit per lock, MAXRWLOCK is at most 8"
+#endif
+#ifndef MAXCOND
+#define MAXCOND       4
+#endif
+#ifndef MAXBASIC
+#define MAXBASIC      8
+#endif
+#ifndef MAXMODETASK
+#define MAXMODETASK   16
+#endif
+#if defined(OS_NO_MUTEX) && !defined(OS_NO_COND)
+#define OS_NO_COND          /** a condition variable needs its mutex */
+#endif
+#define TIMERPRIORITY 0    /** priority of the task that runs timer callbacks */
+
 #define MSECPERTICK   10   /** resolution of a system tick in milliseconds */
 #define MINPRIORITY   10   /** 0 is the highest priority, 10 the lowest */
+#define CLOCKUS       16   /** resolution of the kernel clock (Timer3) in microseconds, 256/16MHz */
+#define MAXBUDGETUS   (65535UL * CLOCKUS)  /** largest CPU budget, about 1.05 s, see Task_SetBudget() */
+#define CYCLESPERUS   16   /** CPU clock in MHz, i.e. OS_Cycles() per microsecond */
+
+#ifndef IDLE_SLEEP_MODE
+#define IDLE_SLEEP_MODE SLEEP_MODE_IDLE  /** deeper modes stop Timer1, i.e. need a tickless kernel */
+#endif
 
 
 #ifndef NULL
 #define NULL          0   /** undefined */
 #endif
 
-#define Disable_Interrupt()     asm volatile ("cli"::)
-#define Enable_Interrupt()      asm volatile ("sei"::)
+#define Disable_Interrupt()     asm volatile ("cli":::"memory")
+#define Enable_Interrupt()      asm volatile ("sei":::"memory")
+
+/**
+  * Nestable critical sections, for the kernel and for applications:
+  *
+  *   CRITICAL_STATE sreg = OS_CriticalEnter();
+  *   ...
+  *   OS_CriticalExit(sreg);
+  *
+  * Enter saves SREG and disables interrupts, exit puts the saved SREG back.
+  * Only the outermost section re-enables interrupts, and a section inside
+  * an ISR or the kernel leaves them disabled. Both are compiler memory
+  * barriers, so data that is only touched inside critical sections, the
+  * kernel or ISRs does not have to be volatile.
+  */
+typedef unsigned char CRITICAL_STATE;
+
+static inline CRITICAL_STATE OS_CriticalEnter(void) {
+    CRITICAL_STATE sreg;
+
+    asm volatile ("in %0, __SREG__" "\n\t" "cli" : "=r" (sreg) : : "memory");
+
+    return sreg;
+}
+
+static inline void OS_CriticalExit(CRITICAL_STATE sreg) {
+    asm volatile ("out __SREG__, %0" : : "r" (sreg) : "memory");
+}
 
 typedef void (*voidfuncptr) (void);      /** pointer to void f(void) */
+typedef void (*timerfuncptr) (int);      /** pointer to void f(int), a timer callback */
 
 typedef unsigned int PID;        /** always non-zero if it is valid */
-typedef unsigned int MUTEX;      /** always non-zero if it is valid */
-typedef unsigned int PRIORITY;
-typedef unsigned int EVENT;      /** always non-zero if it is valid */
+typedef unsigned char MUTEX;     /** always non-zero if it is valid */
+typedef unsigned char PRIORITY;
+typedef unsigned char EVENT;     /** always non-zero if it is valid */
+typedef unsigned char TIMER;
+typedef unsigned char RWLOCK;
+typedef unsigned char COND;
+typedef unsigned char NOTIFY;    /** a task's notification bits */
+typedef unsigned char BASIC;     /** a run-to-completion job, see Basic_Create() */
+typedef unsigned char OPMODE;    /** an operating mode, see Mode_Declare() */
 typedef unsigned int TICK;
 
+/**
+  * CPU residency of the kernel idle loop, in units of CLOCKUS.
+  */
+typedef struct IdleStats {
+    unsigned long idleTime;   /* time spent asleep with nothing to run */
+    unsigned long upTime;     /* time since setup() started the timers */
+    unsigned int sleeps;      /* number of times the CPU was put to sleep */
+    unsigned long switches;   /* dispatches that changed the running task */
+} IDLE_STATS;
+
 /**
   *  This is the set of states that a task can be in at any given time.
   */
@@ -34,6 +121,14 @@ typedef enum process_states {
     SLEEPING,
     BLOCKED_ON_MUTEX,
     WAITING_ON_EVENT,
+    WAITING_ON_TIMER,
+    BLOCKED_ON_RWLOCK,
+    WAITING_ON_COND,
+    WAITING_ON_NOTIFY,
+    WAITING_ON_JOIN,
+    WAITING_ON_BASIC,
+    WAITING_ON_WORK,
+    WAITING_ON_PERIOD,
     TERMINATED
 } PROCESS_STATES;
 
@@ -53,7 +148,37 @@ typedef enum kernel_request_type {
     MUTEX_UNLOCK,
     EVENT_INIT,
     EVENT_WAIT,
-    EVENT_SIGNAL
+    EVENT_SIGNAL,
+    TIMER_CREATE,
+    TIMER_START,
+    TIMER_STOP,
+    TIMER_RELOAD,
+    TIMER_WAIT,
+    PERIOD_SET,
+    PERIOD_WAIT,
+    RWLOCK_INIT,
+    RWLOCK_LOCK,
+    RWLOCK_UNLOCK,
+    COND_INIT,
+    COND_WAIT,
+    COND_SIGNAL,
+    COND_BROADCAST,
+    NOTIFY_WAIT,
+    NOTIFY_WAIT_TIMEOUT,
+    JOIN_WAIT,
+    JOIN_WAIT_TIMEOUT,
+    SET_PRIORITY,
+    SET_THRESHOLD,
+    MUTEX_UNLOCK_SLEEP,
+    MUTEX_UNLOCK_WAIT,
+    EVENT_SIGNAL_WAIT,
+    SET_BUDGET,
+    MODE_SET,
+    MODE_BOUNDARY,
+    BASIC_CREATE,
+    BASIC_WAIT,
+    WORK_INIT,
+    WORK_WAIT
 } KERNEL_REQUEST_TYPE;
 
 /**
@@ -71,9 +196,9 @@ typedef enum mutex_state {
   */
 typedef struct Mutex {
     MUTEX m;
-    MUTEX_STATE state;
+    unsigned char state;      /* MUTEX_STATE */
+    unsigned char lockCount;
     PID owner;
-    unsigned int lockCount;
 } MTX;
 
 /**
@@ -91,53 +216,385 @@ typedef enum event_state {
   */
 typedef struct Event {
     EVENT e;
-    EVENT_STATE state;
+    unsigned char state;      /* EVENT_STATE */
     PID p;
 } EVT;
 
 /**
-  * Each task is represented by a process descriptor, which contains all
-  * relevant information about this task. For convenience, we also store
-  * the task's stack, i.e., its workspace, in here.
+  *  This is the set of states that a timer can be in at any given time.
   */
-typedef struct ProcessDescriptor {
+typedef enum timer_state {
+    UNUSED,
+    STOPPED,
+    ACTIVE
+} TIMER_STATE;
+
+/**
+  *  A one-shot timer stops after it fires, a periodic one reloads itself.
+  */
+typedef enum timer_mode {
+    ONE_SHOT,
+    PERIODIC
+} TIMER_MODE;
+
+/**
+  * Each software timer is represented by a timer struct. Its callback runs
+  * in the timer task, which the kernel creates with the first timer.
+  */
+typedef struct Timer {
+    TIMER t;
+    unsigned char state;      /* TIMER_STATE */
+    unsigned char mode;       /* TIMER_MODE */
+    TICK period;
+    TICK expiry;              /* tick count of the next expiry */
+    timerfuncptr f;
+    int arg;
+} TMR;
+
+/**
+  * A basic task: a job that runs to completion each time it is activated,
+  * by its period or by Basic_Activate(). It has no stack of its own, all
+  * jobs run one at a time on the stack of the basic task runner, which
+  * the kernel creates with the first job.
+  */
+typedef struct BasicTask {
+    BASIC b;
+    unsigned char used;
+    PRIORITY py;
+    unsigned char pending;    /* activations not yet run */
+    voidfuncptr f;
+    TICK period;              /* 0 if only activated by Basic_Activate() */
+    TICK release;             /* tick count of the next periodic activation */
+} BSC;
+
+/**
+  * A deferred work item: f(arg) is run later, at priority py, by the
+  * kernel's worker task. The caller owns the item (usually a static), so
+  * an ISR queues it without allocating anything. Queued items form one
+  * list, highest priority first and first come first served within a
+  * priority.
+  */
+typedef struct Work {
+    struct Work *next;        /* next queued item */
+    timerfuncptr f;
+    int arg;
+    PRIORITY py;
+    unsigned char queued;     /* in the list, not yet taken by the worker */
+} WORK;
+
+/**
+  *  How Task_Notify() changes the notification bits of the target.
+  */
+typedef enum notify_action {
+    NOTIFY_SET_BITS,  /* or in the bits, e.g. one bit per event source */
+    NOTIFY_INCREMENT, /* count, the bits argument is ignored */
+    NOTIFY_OVERWRITE  /* replace, i.e. a one byte mailbox */
+} NOTIFY_ACTION;
+
+#define NOTIFY_NO_WAIT   0        /** Task_NotifyWait() timeout: only poll */
+#define NOTIFY_FOREVER   0xFFFF   /** Task_NotifyWait() timeout: no timeout */
+
+#define JOIN_NO_WAIT     0        /** Task_Join() timeout: only poll */
+#define JOIN_FOREVER     0xFFFF   /** Task_Join() timeout: no timeout */
+
+/**
+  *  This is the set of states that a reader-writer lock can be in.
+  */
+typedef enum rwlock_state {
+    RW_DISABLED,
+    RW_FREE,
+    RW_READ,
+    RW_WRITE
+} RWLOCK_STATE;
+
+/**
+  * Each reader-writer lock is represented by a rwlock struct. Any number of
+  * readers or one writer hold it. A waiting writer keeps new readers out,
+  * and the writer inherits the priority of the tasks it blocks.
+  */
+typedef struct RwLock {
+    RWLOCK l;
+    unsigned char state;           /* RWLOCK_STATE */
+    unsigned char readers;         /* tasks holding it for reading */
+    unsigned char readersWaiting;
+    unsigned char writersWaiting;
+    PID writer;                    /* holder while RW_WRITE */
+} RWL;
+
+/**
+  *  What the kernel does when a periodic task misses its deadline.
+  *  Misses are always counted.
+  */
+typedef enum overrun_policy {
+    OVERRUN_LOG,      /* only count, late releases run back to back */
+    OVERRUN_SKIP,     /* drop the releases that are already in the past */
+    OVERRUN_HOOK      /* like OVERRUN_LOG, and call the task's overrun hook */
+} OVERRUN_POLICY;
+
+/**
+  * The settings of a task in one mode, see Mode_Declare(). A task with no
+  * entry for the current mode is parked at a job boundary, one with no
+  * entries at all is not affected by mode changes.
+  */
+typedef struct ModeTask {
     PID p;
+    OPMODE mode;
+    PRIORITY py;
+    TICK period;              /* 0 keeps the task's own */
+} MODE_TASK;
+
+/**
+  *  What the kernel does with a task that used up its CPU budget.
+  */
+typedef enum budget_policy {
+    BUDGET_THROTTLE,  /* stop it until the budget is replenished, or it unlocks */
+    BUDGET_DEMOTE     /* let it run only when nothing else is ready */
+} BUDGET_POLICY;
+
+/**
+  * CPU budget statistics of a task, see Task_SetBudget().
+  */
+typedef struct BudgetStats {
+    unsigned long budget;         /* microseconds per budget period */
+    unsigned long used;           /* microseconds used in the current period */
+    unsigned int overruns;        /* periods in which the budget ran out */
+} BUDGET_STATS;
+
+/**
+  * Timing statistics of a periodic task, see Task_SetPeriod().
+  */
+typedef struct PeriodStats {
+    unsigned int releases;        /* periods completed */
+    unsigned int deadlineMisses;  /* periods that completed after their deadline */
+    unsigned int skippedReleases; /* releases dropped by OVERRUN_SKIP */
+} PERIOD_STATS;
+
+/**
+  * The arguments of a kernel request. A task makes one request at a time,
+  * so they share storage. Blocking requests keep theirs until they return
+  * (e.g. "m" while BLOCKED_ON_MUTEX, "sleep" while SLEEPING).
+  */
+typedef union KernelArgs {
+    struct {
+        voidfuncptr code;
+        int arg;
+        PRIORITY py;
+    } create;
+    struct {
+        TICK wakeTickOverflow;
+        TICK wakeTick;
+        PID join;            /* task waited for by Task_Join() */
+    } sleep;
+    struct {
+        timerfuncptr f;
+        int arg;
+        TICK period;
+        unsigned char mode;
+    } timerCreate;
+    struct {
+        TIMER t;
+        TICK period;
+    } timer;
+    struct {
+        TICK period;
+        TICK deadline;
+        unsigned char policy;
+    } period;
+    struct {
+        RWLOCK l;
+        unsigned char write;
+    } rw;
+    struct {
+        MUTEX m;          /* first, it becomes "m" once the waiter is signalled */
+        COND c;
+    } cond;
+    struct {
+        PID pid;
+        PRIORITY py;
+    } priority;
+    struct {
+        voidfuncptr f;
+        PRIORITY py;
+        TICK period;
+    } basicCreate;
+    struct {
+        WORK *w;
+        timerfuncptr f;
+        int arg;
+        PRIORITY py;
+    } workInit;
+    struct {
+        timerfuncptr f;   /* NULL if there was no work */
+        int arg;
+    } work;
+    struct {
+        MUTEX m;          /* first, the unlock reads it as "m" */
+        TICK t;
+    } unlockSleep;
+    struct {
+        MUTEX m;          /* first, the unlock reads it as "m" */
+        EVENT wait;
+    } unlockWait;
+    struct {
+        EVENT e;          /* first, the signal reads it as "e" */
+        EVENT wait;
+    } signalWait;
+    OPMODE mode;
+    struct {
+        PID pid;
+        unsigned int budget;  /* in units of CLOCKUS */
+        TICK period;
+        unsigned char policy;
+    } budget;
+    MUTEX m;
+    EVENT e;
+    PID pid;              /* target of suspend / resume */
+} KERNEL_ARGS;
+
+/**
+  * Each task is represented by a process descriptor, which contains the
+  * fields the scheduler looks at. They are packed so that scanning the
+  * process table stays within a few bytes per task.
+  */
+typedef struct ProcessDescriptor {
     unsigned char *sp;   /* stack pointer into the "workSpace" */
-    unsigned char workSpace[WORKSPACE]; 
-    PROCESS_STATES state;
+    PID p;
+    unsigned char state;          /* PROCESS_STATES */
     PRIORITY py;
     PRIORITY inheritedPy;
-    int arg;
-    voidfuncptr  code;   /* function to be executed as a task */
-    KERNEL_REQUEST_TYPE request;
-    unsigned int response;
-    TICK wakeTickOverflow;
-    TICK wakeTick;
-    MUTEX m;
+    PRIORITY threshold;           /* preemption threshold, MINPRIORITY if none */
     EVENT eWait;
-    EVENT eSend;
-    unsigned int suspended;
-    PID pidAction;
+    unsigned char request;        /* KERNEL_REQUEST_TYPE */
+    unsigned char suspended : 1;
+    unsigned char started : 1;    /* running, or preempted since it last ran */
+    unsigned char budgeted : 1;   /* CPU time is limited, see Task_SetBudget() */
+    unsigned char throttled : 1;  /* out of budget, parked like suspended */
+    unsigned char demoted : 1;    /* out of budget, ranked at MINPRIORITY */
+    unsigned char leaving : 1;    /* not in the new mode, parked at its next boundary */
+    unsigned char modeParked : 1; /* parked like suspended, until a mode it is declared in */
+    NOTIFY notify;                /* pending notification bits */
+    NOTIFY notifyMask;            /* bits waited for while WAITING_ON_NOTIFY */
+    unsigned int response;
+    KERNEL_ARGS args;
 } PD;
 
+/**
+  * The priority the scheduler ranks p at. Once a task has been dispatched
+  * it keeps its preemption threshold, if that is higher, until it blocks,
+  * sleeps or yields, so only tasks above the threshold preempt it.
+  */
+#define SCHED_PRIORITY(p)   ((p)->demoted ? MINPRIORITY : \
+                             (((p)->started && ((p)->threshold < (p)->inheritedPy)) ? (p)->threshold : (p)->inheritedPy))
+
+/**
+  * The rarely used part of a task: its stack and how it was created.
+  * Kept in a table parallel to the process descriptors.
+  */
+typedef struct ProcessInfo {
+    unsigned char *workSpace;
+    unsigned int workSpaceSize;
+    voidfuncptr code;    /* function to be executed as a task */
+    int arg;
+#ifndef OS_NO_PERIOD
+    TICK period;         /* 0 if the task is not periodic */
+    TICK deadline;       /* relative to the release */
+    TICK release;        /* tick count of the current release */
+    unsigned char policy;          /* OVERRUN_POLICY */
+    voidfuncptr overrunHook;
+    PERIOD_STATS stats;
+#endif
+#ifndef OS_NO_RWLOCK
+    unsigned char readHeld;    /* bit l is set while it holds lock l for reading */
+#endif
+#ifndef OS_NO_BUDGET
+    unsigned int budget;       /* CPU time per budget period, in CLOCKUS units */
+    TICK budgetPeriod;
+    unsigned char budgetPolicy;    /* BUDGET_POLICY */
+    unsigned int overruns;     /* periods in which the budget ran out */
+    TICK replenish;            /* tick count of the next replenishment */
+    unsigned long used;        /* CPU time used in this budget period */
+    unsigned long dispatched;  /* Kernel_Clock() when last dispatched or charged */
+#endif
+#ifndef OS_NO_NOTIFY
+    PID exitWatcher;     /* notified with exitBits when the task terminates */
+    NOTIFY exitBits;     /* 0 if nobody watches */
+#endif
+} PINFO;
+
 // void OS_Init(void);      redefined as main()
 void OS_Abort(void);
+void OS_SetIdleHook(voidfuncptr hook);  // runs with no current task, must not make kernel calls
+void OS_IdleStats(IDLE_STATS *s);
+unsigned long OS_Cycles(void);   // CPU cycles since setup(), wraps after 268 s
+unsigned long OS_TimeUs(void);   // microseconds since setup(), wraps after 268 s
+void OS_IsrCall(voidfuncptr f);  // from an ISR: runs f on the interrupt stack
+unsigned int OS_IsrStackFree(void);  // bytes of the interrupt stack never used so far
 
 PID  Task_Create( void (*f)(void), PRIORITY py, int arg);
 void Task_Terminate(void);
 void Task_Next(void); // Same as yield
 int  Task_GetArg( PID p );
+PID  Task_GetPid(void);              // the calling task's own PID
 void Task_Suspend( PID p );          
 void Task_Resume( PID p );
+void Task_SetPriority(PID p, PRIORITY py);  // takes effect at once, inheritance is recomputed
+void Task_SetThreshold(PID p, PRIORITY threshold);  // only tasks above it preempt p once it runs
+void Task_SetBudget(PID p, unsigned long budgetUs, TICK period, BUDGET_POLICY policy);  // period 0 lifts it, budgetUs is clamped to MAXBUDGETUS
+void Task_SetServer(PID p, unsigned long budgetUs, TICK period);  // a deferrable server, i.e. BUDGET_THROTTLE
+void Task_GetBudgetStats(PID p, BUDGET_STATS *s);
+
+void Mode_Declare(PID p, OPMODE m, PRIORITY py, TICK period);  // p runs in mode m at py, period 0 keeps its own
+void Mode_Set(OPMODE m);               // parks, releases and reconfigures the declared tasks
+OPMODE Mode_Get(void);
+void Mode_Boundary(void);            // a job boundary, for tasks that do not call Task_WaitPeriod()
+unsigned int Task_StackFree(PID p);  // bytes of p's workspace never used so far
+unsigned int Task_Join(PID p, TICK timeout);  // waits for p to terminate, returns 0 on timeout
 
 void Task_Sleep(TICK t);  // sleep time is at least t*MSECPERTICK
 
+void Task_SetPeriod(TICK period, TICK deadline, OVERRUN_POLICY policy, voidfuncptr hook);  // first release is now
+unsigned int Task_WaitPeriod(void);  // sleeps until the next release, returns 1 if the deadline was missed
+void Task_GetPeriodStats(PID p, PERIOD_STATS *s);
+
 MUTEX Mutex_Init(void);
 void Mutex_Lock(MUTEX m);
 void Mutex_Unlock(MUTEX m);
+void Mutex_UnlockAndSleep(MUTEX m, TICK t);   // one kernel entry for both
+void Mutex_UnlockAndWait(MUTEX m, EVENT e);   // no signal of e is missed in between
 
 EVENT Event_Init(void);
 void Event_Wait(EVENT e);
 void Event_Signal(EVENT e);
+void Event_SignalAndWait(EVENT signal, EVENT wait);  // one kernel entry for both
+
+RWLOCK RwLock_Init(void);            // MAXRWLOCK if there is none left, a task reads a lock once at a time
+void RwLock_ReadLock(RWLOCK l);      // shared with other readers
+void RwLock_ReadUnlock(RWLOCK l);
+void RwLock_WriteLock(RWLOCK l);     // exclusive
+void RwLock_WriteUnlock(RWLOCK l);
+
+void Task_Notify(PID p, NOTIFY bits, NOTIFY_ACTION action);
+NOTIFY Task_NotifyWait(NOTIFY mask, TICK timeout);  // returns and clears the pending bits in mask, 0 on timeout
+void Task_NotifyFromISR(PID p, NOTIFY bits, NOTIFY_ACTION action);  // finish the ISR with OS_IsrExit()
+void OS_IsrExit(void);  // last call of an ISR that readied a task, switches to it
+void Task_NotifyOnExit(PID p, NOTIFY bits);  // the caller is notified with bits when p terminates
+
+COND Cond_Init(void);                // MAXCOND if there is none left
+void Cond_Wait(COND c, MUTEX m);     // m must be locked once by the caller, it is locked again on return
+void Cond_Signal(COND c);            // wakes the highest priority waiter
+void Cond_Broadcast(COND c);         // wakes every waiter
+
+BASIC Basic_Create(voidfuncptr f, PRIORITY py, TICK period);  // f must not block; period 0: Basic_Activate() only
+void Basic_Activate(BASIC b);        // queues one run of b
+void Basic_ActivateFromISR(BASIC b); // finish the ISR with OS_IsrExit()
+
+void Work_Init(WORK *w, timerfuncptr f, int arg, PRIORITY py);  // f must not block; w must not be queued
+unsigned int Work_Submit(WORK *w);        // 0 if w is already queued
+unsigned int Work_SubmitFromISR(WORK *w); // finish the ISR with OS_IsrExit()
+
+TIMER Timer_Create(timerfuncptr f, int arg, TICK period, TIMER_MODE mode);  // MAXTIMER if there is none left
+void Timer_Start(TIMER t);                 // first expiry is one period from now
+void Timer_Stop(TIMER t);
+void Timer_Reload(TIMER t, TICK period);   // change the period and restart
 
 #endif /* _OS_H_ */
@@ -0,0 +1,82 @@
+#ifndef _OS_STATIC_H_
+#define _OS_STATIC_H_
+
+/**
+  * Static (compile time) configuration of tasks, mutexes and events.
+  *
+  * Build everything with -DSTATIC_CONFIG and put an "os_config.h" on the
+  * include path that lists the kernel objects of the application:
+  *
+  *   #define OS_TASKS(TASK) \
+  *       TASK(Init_Task,  0, 0, 128) \
+  *       TASK(Laser_Task, 2, 3, 96)
+  *
+  *   #define OS_MUTEXES(MUTEX) \
+  *       MUTEX(laserMutex)
+  *
+  *   #define OS_EVENTS(EVENT) \
+  *       EVENT(sensorEvent)
+  *
+  * TASK(function, priority, arg, stack bytes). The kernel tables, stacks
+  * and the ready queue are laid out at compile time from these lists, so
+  * MAXTHREAD, MAXMUTEX and MAXEVENT are exactly what is used. All listed
+  * tasks are READY when OS_Start() runs and a_main() is not created.
+  *
+  * For each task "f" the constant "f_PID" is its PID, the task's index in
+  * the list with generation 1 (see Kernel_Create_Task_At()). Configured
+  * tasks never give up their slot, so it stays valid. Mutexes and events
+  * are used directly by name, without Mutex_Init() or Event_Init().
+  *
+  * Optional settings in os_config.h:
+  *   OS_EXTRA_TASKS  slots (of WORKSPACE bytes) left for Task_Create()
+  *   OS_NO_MUTEX     compile the mutex service out of the kernel
+  *   OS_NO_EVENT     compile the event service out of the kernel
+  *   OS_NO_TIMER     compile the software timers out of the kernel
+  *   OS_NO_PERIOD    compile periodic task support out of the kernel
+  *   OS_NO_RWLOCK    compile the reader-writer locks out of the kernel
+  *   MAXRWLOCK       number of reader-writer locks, made by RwLock_Init()
+  *   OS_NO_NOTIFY    compile the task notifications out of the kernel
+  *   OS_NO_JOIN      compile Task_Join() out of the kernel
+  *   OS_NO_BUDGET    compile the CPU budgets of Task_SetBudget() out
+  *   OS_NO_MODE      compile the mode changes out of the kernel
+  *   MAXMODETASK     number of Mode_Declare() entries
+  *   OS_NO_COND      compile the condition variables out of the kernel,
+  *                   implied by OS_NO_MUTEX
+  *   MAXCOND         number of condition variables, made by Cond_Init()
+  *   MAXTIMER        number of software timers; the timer task needs
+  *                   one OS_EXTRA_TASKS slot
+  *   OS_NO_BASIC     compile the basic (run-to-completion) tasks out
+  *   MAXBASIC        number of basic tasks; their runner needs one
+  *                   OS_EXTRA_TASKS slot
+  *   OS_NO_WORK      compile the deferred work queue out; its worker
+  *                   needs one OS_EXTRA_TASKS slot
+  */
+
+#include "os_config.h"
+
+#ifndef OS_EXTRA_TASKS
+#define OS_EXTRA_TASKS  0
+#endif
+
+#ifndef OS_MUTEXES
+#define OS_MUTEXES(MUTEX)
+#endif
+
+#ifndef OS_EVENTS
+#define OS_EVENTS(EVENT)
+#endif
+
+#define OS_TASK_ID(f, pri, a, size)     f##_Index,
+#define OS_TASK_PID(f, pri, a, size)    f##_PID = (1 << PID_SLOT_BITS) | f##_Index,
+#define OS_OBJECT_ID(name)              name,
+
+enum { OS_TASKS(OS_TASK_ID) STATIC_TASKS };
+enum { OS_TASKS(OS_TASK_PID) STATIC_PIDS_END };
+enum { OS_MUTEXES(OS_OBJECT_ID) STATIC_MUTEXES };
+enum { OS_EVENTS(OS_OBJECT_ID) STATIC_EVENTS };
+
+#define MAXTHREAD     (STATIC_TASKS + OS_EXTRA_TASKS)
+#define MAXMUTEX      STATIC_MUTEXES
+#define MAXEVENT      STATIC_EVENTS
+
+#endif /* _OS_STATIC_H_ */
@@ -3,18 +3,18 @@
 /*
  *  Checks if queue is full
  */
-volatile int isFull(volatile int *QCount) {
-    return *QCount == MAXTHREAD - 1;
+int isFull(int *QCount) {
+    return *QCount == MAXTHREAD;
 }
 
 /*
  *  Checks if queue is empty, READY QUEUE SHOULD NEVER BE EMPTY
  */
-volatile int isEmpty(volatile int *QCount) {
+int isEmpty(int *QCount) {
     return *QCount == 0;
 }
 
-void enqueueWQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
+void enqueueWQ(PD **p, PD **Queue, int *QCount) {
     if(isFull(QCount)) {
         return;
     }
@@ -30,18 +30,18 @@ void enqueueWQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
     (*QCount)++;
 }
 
-void enqueueSQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
+void enqueueSQ(PD **p, PD **Queue, int *QCount) {
     if(isFull(QCount)) {
         return;
     }
 
     int i = (*QCount) - 1;
 
-    volatile PD *new = *p;
+    PD *new = *p;
 
-    volatile PD *temp = Queue[i];
+    PD *temp = Queue[i];
 
-    while(i >= 0 && ((new->wakeTickOverflow > temp->wakeTickOverflow) || ((new->wakeTickOverflow >= temp->wakeTickOverflow) && (new->wakeTick >= temp->wakeTick)))) {
+    while(i >= 0 && ((new->args.sleep.wakeTickOverflow > temp->args.sleep.wakeTickOverflow) || ((new->args.sleep.wakeTickOverflow >= temp->args.sleep.wakeTickOverflow) && (new->args.sleep.wakeTick >= temp->args.sleep.wakeTick)))) {
         Queue[i+1] = Queue[i];
         i--;
         temp = Queue[i];
@@ -52,20 +52,20 @@ void enqueueSQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
 }
 
 /*
- *  Insert into the queue sorted by priority
+ *  Insert into the queue sorted by priority, see SCHED_PRIORITY()
  */
-void enqueueRQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
+void enqueueRQ(PD **p, PD **Queue, int *QCount) {
     if(isFull(QCount)) {
         return;
     }
 
     int i = (*QCount) - 1;
 
-    volatile PD *new = *p;
+    PD *new = *p;
 
-    volatile PD *temp = Queue[i];
+    PD *temp = Queue[i];
 
-    while(i >= 0 && (new->inheritedPy >= temp->inheritedPy)) {
+    while(i >= 0 && (SCHED_PRIORITY(new) >= SCHED_PRIORITY(temp))) {
         Queue[i+1] = Queue[i];
         i--;
         temp = Queue[i];
@@ -78,16 +78,16 @@ void enqueueRQ(volatile PD **p, volatile PD **Queue, volatile int *QCount) {
 /*
  *  Return the first element of the queue with the correct MUTEX m
  */
-volatile PD *dequeueWQ(volatile PD **Queue, volatile int *QCount, MUTEX m) {
+PD *dequeueWQ(PD **Queue, int *QCount, MUTEX m) {
 
     if(isEmpty(QCount)) {
         return NULL;
     }
 
     int i,j;
-    volatile PD* result = NULL;
+    PD* result = NULL;
     for (i = (*QCount)-1; i>=0; i--) {
-        if(Queue[i]->m == m){
+        if(Queue[i]->args.m == m){
             result = Queue[i];
             break;
         }
@@ -104,29 +104,42 @@ volatile PD *dequeueWQ(volatile PD **Queue, volatile int *QCount, MUTEX m) {
 }
 
 /*
- *  Return the first element of the Ready Queue
+ *  Remove p from wherever it is in the queue, returns 0 if it was not there
  */
-volatile PD *dequeueRQ(volatile PD **Queue, volatile int *QCount) {
+int removeQ(PD *p, PD **Queue, int *QCount) {
+    int i;
 
-    if(isEmpty(QCount)) {
-        return NULL;
-    }
-
-    int i,j;
-    volatile PD* result = NULL;
     for (i = (*QCount)-1; i >= 0; i--) {
-        if((Queue[i]->suspended == 0) && (Queue[i]->state == READY)) {
-            result = Queue[i];
+        if(Queue[i] == p) {
             break;
         }
     }
-    if(result != NULL) {
-        while(i < (*QCount)-1) {
-            Queue[i] = Queue[i+1];
-            i++;
-        }
-        (*QCount)--;
+
+    if(i < 0) {
+        return 0;
+    }
+
+    while(i < (*QCount)-1) {
+        Queue[i] = Queue[i+1];
+        i++;
     }
+    (*QCount)--;
+
+    return 1;
+}
+
+/*
+ *  Return the first element of the Ready Queue. Only READY tasks are ever
+ *  queued, suspended and waiting tasks are kept out of it.
+ */
+PD *dequeueRQ(PD **Queue, int *QCount) {
+
+    if(isEmpty(QCount)) {
+        return NULL;
+    }
+
+    PD *result = (Queue[(*QCount)-1]);
+    (*QCount)--;
 
     return result;
 }
@@ -134,13 +147,13 @@ volatile PD *dequeueRQ(volatile PD **Queue, volatile int *QCount) {
 /*
  *  Return the first element of the queue
  */
-volatile PD *dequeue(volatile PD **Queue, volatile int *QCount) {
+PD *dequeue(PD **Queue, int *QCount) {
 
     if(isEmpty(QCount)) {
         return;
     }
 
-    volatile PD *result = (Queue[(*QCount)-1]);
+    PD *result = (Queue[(*QCount)-1]);
     (*QCount)--;
 
     return result;
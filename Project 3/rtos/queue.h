@@ -3,20 +3,21 @@
 
 #include "os.h"
 
-volatile int isFull(volatile int *QCount);
-volatile int isEmpty(volatile int *QCount);
-void enqueueSQ(volatile PD **p, volatile PD **Queue, volatile int *QCount);
-void enqueueRQ(volatile PD **p, volatile PD **Queue, volatile int *QCount);
-volatile PD *dequeueRQ(volatile PD **Queue, volatile int *QCount);
-volatile PD *dequeue(volatile PD **Queue, volatile int *QCount);
+int isFull(int *QCount);
+int isEmpty(int *QCount);
+void enqueueSQ(PD **p, PD **Queue, int *QCount);
+void enqueueRQ(PD **p, PD **Queue, int *QCount);
+int removeQ(PD *p, PD **Queue, int *QCount);
+PD *dequeueRQ(PD **Queue, int *QCount);
+PD *dequeue(PD **Queue, int *QCount);
 
-extern volatile PD *ReadyQueue[MAXTHREAD];
-extern volatile int RQCount;
+extern PD *ReadyQueue[MAXTHREAD];
+extern int RQCount;
 
-extern volatile PD *SleepQueue[MAXTHREAD];
-extern volatile int SQCount;
+extern PD *SleepQueue[MAXTHREAD];
+extern int SQCount;
 
-extern volatile PD *WaitingQueue[MAXTHREAD];
-extern volatile int WQCount;
+extern PD *WaitingQueue[MAXTHREAD];
+extern int WQCount;
 
 #endif /* _QUEUE_H_ */
@@ -0,0 +1,53 @@
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+/**
+  * Double-buffered state publication, for one writer task and any number
+  * of readers. Neither side enters the kernel or disables interrupts.
+  *
+  *   typedef struct { int bump; int wall; } SENSORS;
+  *   SEQ_BUFFER(SENSORS) sensors;
+  *
+  *   writer:  SENSORS *s = SEQ_WRITE_BUFFER(sensors);
+  *            s->bump = ...; s->wall = ...;
+  *            SEQ_PUBLISH(sensors);
+  *
+  *   reader:  SENSORS view;
+  *            SEQ_READ(sensors, view);
+  *
+  * The writer fills the buffer readers are not looking at and then flips
+  * "seq", a single byte store. A reader copies the current buffer and
+  * retries only if the writer published while it was copying, so it never
+  * waits for a writer that it preempted in the middle of an update. With a
+  * single CPU a retry needs the writer to have run, so readers of higher
+  * priority than the writer never retry.
+  */
+
+/** Compiler barrier, keeps the buffer accesses between the seq accesses */
+#define SEQ_BARRIER()           asm volatile ("" ::: "memory")
+
+/** Declares a double buffer holding values of "type" */
+#define SEQ_BUFFER(type)        struct { volatile unsigned char seq; type buf[2]; }
+
+/** The buffer the writer may fill, readers use the other one */
+#define SEQ_WRITE_BUFFER(name)  (&((name).buf[((name).seq + 1) & 1]))
+
+/** Makes the filled write buffer the current one */
+#define SEQ_PUBLISH(name)       do { SEQ_BARRIER(); (name).seq++; } while (0)
+
+/** Fills and publishes in one go */
+#define SEQ_WRITE(name, value)  do { *SEQ_WRITE_BUFFER(name) = (value); SEQ_PUBLISH(name); } while (0)
+
+/** Copies a consistent snapshot of the current value into "out" */
+#define SEQ_READ(name, out)                             \
+    do {                                                \
+        unsigned char _seq;                             \
+        do {                                            \
+            _seq = (name).seq;                          \
+            SEQ_BARRIER();                              \
+            (out) = (name).buf[_seq & 1];               \
+            SEQ_BARRIER();                              \
+        } while ((name).seq != _seq);                   \
+    } while (0)
+
+#endif /* _SEQLOCK_H_ */
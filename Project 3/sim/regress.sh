@@ -0,0 +1,165 @@
+#!/bin/bash
+#
+# Scheduling order regression harness.
+#
+# Builds every "Project 2/test*.c" program, and the tests of this kernel's
+# own features in sim/tests/ and sim/static/, against the kernel in rtos/ with
+# -DTRACE, runs it in simavr and compares the order in which tasks were
+# dispatched against the "EXPECTED RUNNING ORDER" comment of the test.
+# The time between consecutive switches is reported in microseconds.
+#
+# Usage: sim/regress.sh [test.c ...]       (run from "Project 3")
+#
+# Tests that program Timer1, Timer3 or Timer5 themselves are skipped: the
+# kernel owns those timers and their interrupt vectors (test4 defines
+# TIMER3_COMPA_vect and would not link).
+#
+# A test with an os_config.h next to it (sim/static/) is built with
+# -DSTATIC_CONFIG against that configuration instead of creating a_main.
+#
+# Tasks are named after their function, Task_P1 -> P1. a_main and Idle are
+# left out of the comparison. Tokens in the expected order that are not
+# tasks (e.g. TIMER in test4) are dropped. "P1, ..., P15" is expanded.
+#
+
+CC=${CC:-avr-gcc}
+NM=${NM:-avr-nm}
+SIM=${SIM:-simavr}
+SIMFLAGS=${SIMFLAGS:-"-m atmega2560 -f 16000000"}
+SIMAVR_INC=${SIMAVR_INC:-/usr/include/simavr/avr}
+TIMEOUT=${TIMEOUT:-20}
+TESTDIR=${TESTDIR:-"../Project 2"}
+KERNEL=${KERNEL:-rtos}
+BUILD=${BUILD:-build/regress}
+
+if [ $# -gt 0 ]; then
+	TESTS=("$@")
+else
+	TESTS=("$TESTDIR"/test*.c sim/tests/test*.c sim/static/test*.c)
+fi
+
+# ------------------------------ EXPECTED ORDER ------------------------------ //
+expected_order() {
+	grep -m1 'EXPECTED RUNNING ORDER:' "$1" | sed 's/.*EXPECTED RUNNING ORDER://' | awk '
+	{
+		n = split($0, tok, ",")
+		out = ""
+		prev = -1
+		gap = 0
+		for (i = 1; i <= n; i++) {
+			t = tok[i]
+			gsub(/[ \t\r]/, "", t)
+			if (t == "...") {
+				gap = 1
+				continue
+			}
+			if (t !~ /^P[0-9]+$/) {
+				continue
+			}
+			cur = substr(t, 2) + 0
+			if (gap && prev >= 0) {
+				for (k = prev + 1; k < cur; k++) {
+					out = out " P" k
+				}
+			}
+			gap = 0
+			out = out " " t
+			prev = cur
+		}
+		print substr(out, 2)
+	}'
+}
+
+# ------------------------------ ACTUAL ORDER ------------------------------ //
+# Turns the "@C" / "@D" trace into "name cycles" lines, one per switch
+actual_order() {
+	local trace=$1
+	local elf=$2
+
+	"$NM" "$elf" | awk '
+	function hex(s,    i, v) {
+		s = tolower(s)
+		v = 0
+		for (i = 1; i <= length(s); i++) {
+			v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+		}
+		return v
+	}
+	NR == FNR {
+		sym[hex($1)] = $3
+		next
+	}
+	$1 == "C" {
+		addr = hex($3) * 2
+		name[$2] = (addr in sym) ? sym[addr] : "pid" $2
+		next
+	}
+	$1 == "D" {
+		n = ($2 in name) ? name[$2] : "pid" $2
+		sub(/^Task_/, "", n)
+		print n, $3
+	}' - "$trace"
+}
+
+pass=0
+fail=0
+
+mkdir -p "$BUILD"
+
+for test in "${TESTS[@]}"; do
+	name=$(basename "$test" .c)
+	dir="$BUILD/$name"
+	mkdir -p "$dir"
+
+	expected=$(expected_order "$test")
+	if [ -z "$expected" ]; then
+		echo "SKIP  $name (no EXPECTED RUNNING ORDER)"
+		continue
+	fi
+
+	if grep -qE 'TIMER[135]_[A-Z]+_vect|T(CCR|CNT|IMSK)[135]|OCR[135]A' "$test"; then
+		echo "SKIP  $name (uses a kernel timer)"
+		continue
+	fi
+
+	config=""
+	if [ -f "$(dirname "$test")/os_config.h" ]; then
+		config="-DSTATIC_CONFIG -I$(dirname "$test")"
+	fi
+
+	# Build a private copy so "os.h" resolves to the kernel under test
+	cp "$test" "$dir/test.c"
+	if ! "$CC" -g -Os -mmcu=atmega2560 -DTRACE $config -I"$KERNEL" -I"$TESTDIR" -I"$SIMAVR_INC" \
+			-o "$dir/test.elf" "$dir/test.c" "$TESTDIR/LED_Test.c" \
+			"$KERNEL/cswitch.S" "$KERNEL/os.c" "$KERNEL/queue.c" sim/sim.c \
+			> "$dir/build.log" 2>&1; then
+		echo "FAIL  $name (build, see $dir/build.log)"
+		fail=$((fail + 1))
+		continue
+	fi
+
+	timeout "$TIMEOUT" "$SIM" $SIMFLAGS "$dir/test.elf" 2>&1 \
+		| sed -e 's/\x1b\[[0-9;]*m//g' | sed -n 's/^.*@//p' > "$dir/trace.txt"
+
+	actual_order "$dir/trace.txt" "$dir/test.elf" > "$dir/switches.txt"
+
+	count=$(echo "$expected" | wc -w)
+	actual=$(awk '$1 != "a_main" && $1 != "Idle" { print $1 }' "$dir/switches.txt" \
+		| head -n "$count" | tr '\n' ' ' | sed 's/ $//')
+
+	if [ "$actual" == "$expected" ]; then
+		echo "PASS  $name"
+		pass=$((pass + 1))
+	else
+		echo "FAIL  $name"
+		echo "      expected: $expected"
+		echo "      actual:   $actual"
+		fail=$((fail + 1))
+	fi
+
+	awk 'NR > 1 { printf "      %-8s +%d us\n", $1, ($2 - last) / 16 } { last = $2 }' "$dir/switches.txt"
+done
+
+echo "$pass passed, $fail failed"
+
+[ $fail -eq 0 ]
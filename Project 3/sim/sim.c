@@ -0,0 +1,118 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr_mcu_section.h>
+#include "../rtos/os.h"
+#include "sim.h"
+
+/**
+  * Tell simavr which part we are and where the console register lives, so
+  * the ELF can be run without any command line configuration.
+  */
+AVR_MCU(16000000, "atmega2560");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+/** Task that was dispatched last, so repeated dispatches are not traced */
+static unsigned int traceLastPid = 0xFFFF;
+
+/** Number of context switches traced so far */
+static unsigned int traceSwitches = 0;
+
+/**
+  * Returns the number of CPU cycles since setup()
+  */
+uint32_t Sim_Cycles() {
+	return OS_Cycles();
+}
+
+/**
+  * Stops the simulation. simavr exits cleanly when the CPU sleeps with
+  * interrupts disabled.
+  */
+void Sim_Exit() {
+	cli();
+	sleep_enable();
+	sleep_cpu();
+}
+
+/**
+  * Writes one character to the simavr console
+  */
+void Sim_Putc(char c) {
+	GPIOR0 = c;
+}
+
+/**
+  * Writes a string to the simavr console
+  */
+void Sim_Puts(const char *s) {
+	while (*s) {
+		Sim_Putc(*s++);
+	}
+}
+
+/**
+  * Writes an unsigned decimal number to the simavr console
+  */
+void Sim_PutUnsigned(uint32_t v) {
+	char buf[11];
+	int i = 0;
+
+	do {
+		buf[i++] = '0' + (v % 10);
+		v /= 10;
+	} while (v > 0);
+
+	while (i > 0) {
+		Sim_Putc(buf[--i]);
+	}
+}
+
+/**
+  * Writes a 16-bit number as four hex digits to the simavr console
+  */
+void Sim_PutHex(uint16_t v) {
+	int i;
+	uint8_t nibble;
+
+	for (i = 12; i >= 0; i -= 4) {
+		nibble = (v >> i) & 0x0F;
+		Sim_Putc(nibble < 10 ? '0' + nibble : 'a' + nibble - 10);
+	}
+}
+
+/**
+  * Records which function a new task runs:  "@C <pid> <code address>"
+  * The address is the word address the kernel stores, i.e. half of the
+  * byte address that avr-nm reports.
+  */
+void Sim_TraceCreate(unsigned int p, void (*f)(void)) {
+	Sim_Putc(SIM_TAG);
+	Sim_Puts("C ");
+	Sim_PutUnsigned(p);
+	Sim_Putc(' ');
+	Sim_PutHex((uint16_t)f);
+	Sim_Putc('\n');
+}
+
+/**
+  * Records a context switch:  "@D <pid> <cycles>"
+  * Stops the simulation after TRACE_LIMIT switches.
+  */
+void Sim_TraceDispatch(unsigned int p) {
+	if (p == traceLastPid) {
+		return;
+	}
+	traceLastPid = p;
+
+	Sim_Putc(SIM_TAG);
+	Sim_Puts("D ");
+	Sim_PutUnsigned(p);
+	Sim_Putc(' ');
+	Sim_PutUnsigned(Sim_Cycles());
+	Sim_Putc('\n');
+
+	if (++traceSwitches >= TRACE_LIMIT) {
+		Sim_Exit();
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stdint.h>
+
+/**
+  * Support code for running the kernel under simavr instead of on the board.
+  *
+  * Text written with Sim_Puts() comes out of simavr's console register, one
+  * line at a time. Sim_Cycles() is the kernel's OS_Cycles() counter.
+  */
+
+#define SIM_TAG     '@'   /** every machine-readable line starts with this */
+
+#ifndef TRACE_LIMIT
+#define TRACE_LIMIT 64    /** context switches traced before the simulation stops */
+#endif
+
+void Sim_Exit(void);
+
+uint32_t Sim_Cycles(void);
+
+void Sim_Putc(char c);
+void Sim_Puts(const char *s);
+void Sim_PutUnsigned(uint32_t v);
+void Sim_PutHex(uint16_t v);
+
+/** Kernel hooks, called from os.c when it is built with -DTRACE */
+void Sim_TraceCreate(unsigned int p, void (*f)(void));
+void Sim_TraceDispatch(unsigned int p);
+
+#endif /* _SIM_H_ */
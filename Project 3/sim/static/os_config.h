@@ -0,0 +1,8 @@
+/**
+  * Static configuration of the static PID regression test, see
+  * test_static_pid.c and rtos/os_static.h.
+  */
+#define OS_TASKS(TASK) \
+    TASK(Task_P1, 1, 0, 128) \
+    TASK(Task_P2, 2, 0, 128) \
+    TASK(Task_P3, 3, 0, 128)
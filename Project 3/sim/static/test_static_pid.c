@@ -0,0 +1,29 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P3, P2
+// Static PID lookup
+//
+// Built with -DSTATIC_CONFIG and the os_config.h next to this file. P1
+// suspends P2 and P3 resumes it, both by the configured constant
+// Task_P2_PID. If that does not match the PID the kernel gave P2, the
+// suspend does nothing and P2 runs right after P1.
+
+void Task_P1()
+{
+    Task_Suspend(Task_P2_PID);
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    Task_Resume(Task_P2_PID);
+
+    for(;;){
+    }
+}
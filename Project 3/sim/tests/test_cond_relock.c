@@ -0,0 +1,53 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P2, P3, P1, P2
+// Cond_Wait() locks the mutex again before it returns
+//
+// P1 waits on the condition. P3 signals it but keeps the mutex and sleeps,
+// so P1 is woken only to block on the mutex, and P3 inherits priority 1.
+// P2 spins from tick 1, yet P3 gets back in at tick 2 and unlocks, and
+// only then does P1 return from Cond_Wait(). If the signal readied P1
+// without the mutex, P1 would run right after P3's signal.
+
+MUTEX mut;
+COND cond;
+
+void Task_P1()
+{
+    Mutex_Lock(mut);
+    Cond_Wait(cond, mut);
+    Mutex_Unlock(mut);
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(1);
+
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    Mutex_Lock(mut);
+    Cond_Signal(cond);
+    Task_Sleep(2);
+    Mutex_Unlock(mut);
+
+    for(;;){
+    }
+}
+
+void a_main()
+{
+    mut = Mutex_Init();
+    cond = Cond_Init();
+
+    Task_Create(Task_P1, 1, 0);
+    Task_Create(Task_P2, 2, 0);
+    Task_Create(Task_P3, 3, 0);
+
+    Task_Terminate();
+}
@@ -0,0 +1,83 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P4, P5, P3, P4, P5, P2, P1, P5, P4, P3, P2
+// Task_SetPriority() down a blocker chain
+//
+// P3 waits on m1 held by P4, and P4 waits on m2 held by P5, so P5 runs at
+// P3's priority 6. Then P2 wakes at 4 and spins, starving the chain, until
+// P1 raises P3 to 2. That has to reach P5 through P4: P5 then runs over P2,
+// hands m2 to P4, which hands m1 to P3. Back at its own 7, P4 is left
+// behind P2. If only the direct blocker P4 is recomputed, P5 stays at 6
+// and P2 keeps the CPU.
+
+MUTEX m1;
+MUTEX m2;
+volatile unsigned char raised;
+PID pidP3;
+
+void Task_P1()
+{
+    Task_Sleep(3);
+
+    raised = 1;
+    Task_SetPriority(pidP3, 2);
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(2);
+
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    Task_Sleep(1);
+
+    Mutex_Lock(m1);
+    Mutex_Unlock(m1);
+
+    Task_Terminate();
+}
+
+void Task_P4()
+{
+    Mutex_Lock(m1);
+    Task_Sleep(1);
+
+    Mutex_Lock(m2);
+    Mutex_Unlock(m2);
+    Mutex_Unlock(m1);
+
+    Task_Terminate();
+}
+
+void Task_P5()
+{
+    Mutex_Lock(m2);
+
+    while (!raised) {
+    }
+
+    Mutex_Unlock(m2);
+
+    for(;;){
+    }
+}
+
+void a_main()
+{
+    m1 = Mutex_Init();
+    m2 = Mutex_Init();
+
+    Task_Create(Task_P1, 1, 0);
+    Task_Create(Task_P2, 4, 0);
+    pidP3 = Task_Create(Task_P3, 6, 0);
+    Task_Create(Task_P4, 7, 0);
+    Task_Create(Task_P5, 8, 0);
+
+    Task_Terminate();
+}
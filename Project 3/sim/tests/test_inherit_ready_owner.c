@@ -0,0 +1,55 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P1, P3, P1, P2
+// Mutex inheritance by a preempted, i.e. READY, owner
+//
+// P3 locks the mutex and is preempted by the tick that wakes P1 and P2.
+// P1 blocks on the mutex, so P3 inherits priority 1 and has to run before
+// P2 even though it sits in the ReadyQueue below P2. If the boost does not
+// move P3 up the queue, P2 runs next and spins forever.
+
+MUTEX mut;
+volatile unsigned char waiting;
+
+void Task_P1()
+{
+    Task_Sleep(1);
+
+    waiting = 1;
+    Mutex_Lock(mut);
+    Mutex_Unlock(mut);
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(1);
+
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    Mutex_Lock(mut);
+
+    while (!waiting) {
+    }
+
+    Mutex_Unlock(mut);
+
+    for(;;){
+    }
+}
+
+void a_main()
+{
+    mut = Mutex_Init();
+
+    Task_Create(Task_P1, 1, 0);
+    Task_Create(Task_P2, 2, 0);
+    Task_Create(Task_P3, 3, 0);
+
+    Task_Terminate();
+}
@@ -0,0 +1,49 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P1, P2, P1, P2
+// Task_Join() without and with a timeout
+//
+// P1 joins P3, which terminates at once, so P1 runs again right after it.
+// P1 then joins P2 for 2 ticks. P2 never terminates, so the join times out
+// and P1 preempts P2 at tick 2. A join that returns the wrong result keeps
+// P1 spinning, and P2 does not run again.
+
+PID pidP2;
+PID pidP3;
+
+void Task_P1()
+{
+    if (!Task_Join(pidP3, JOIN_FOREVER)) {
+        for(;;){
+        }
+    }
+
+    if (Task_Join(pidP2, 2)) {
+        for(;;){
+        }
+    }
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(1);
+
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    Task_Terminate();
+}
+
+void a_main()
+{
+    Task_Create(Task_P1, 1, 0);
+    pidP2 = Task_Create(Task_P2, 2, 0);
+    pidP3 = Task_Create(Task_P3, 3, 0);
+
+    Task_Terminate();
+}
@@ -0,0 +1,55 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P1, P3, P1, P2
+// Reader-writer lock inheritance by a preempted writer
+//
+// P3 holds the lock for writing and is preempted by the tick that wakes P1
+// and P2. P1 blocks reading, so P3 inherits priority 1 and finishes its
+// write before P2 runs. If the boost leaves P3 in its old place in the
+// ReadyQueue, P2 runs next and spins forever.
+
+RWLOCK lock;
+volatile unsigned char tried;
+
+void Task_P1()
+{
+    Task_Sleep(1);
+
+    tried = 1;
+    RwLock_ReadLock(lock);
+    RwLock_ReadUnlock(lock);
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(1);
+
+    for(;;){
+    }
+}
+
+void Task_P3()
+{
+    RwLock_WriteLock(lock);
+
+    while (!tried) {
+    }
+
+    RwLock_WriteUnlock(lock);
+
+    for(;;){
+    }
+}
+
+void a_main()
+{
+    lock = RwLock_Init();
+
+    Task_Create(Task_P1, 1, 0);
+    Task_Create(Task_P2, 2, 0);
+    Task_Create(Task_P3, 3, 0);
+
+    Task_Terminate();
+}
@@ -0,0 +1,56 @@
+#include "os.h"
+//
+// EXPECTED RUNNING ORDER: P1, P2, P3, P2, P3, P1, P3, P2, P1, P2, P3
+// Reader-writer lock writer preference
+//
+// P3 holds the lock for reading. P2 asks to write and waits. P1 then asks
+// to read: it must queue up behind the waiting writer rather than join P3.
+// Once P3 lets go, P2 writes first and only then is P1 let in.
+
+RWLOCK lock;
+volatile unsigned char tried;
+
+void Task_P1()
+{
+    Task_Sleep(2);
+
+    tried = 1;
+    RwLock_ReadLock(lock);
+    RwLock_ReadUnlock(lock);
+
+    Task_Terminate();
+}
+
+void Task_P2()
+{
+    Task_Sleep(1);
+
+    RwLock_WriteLock(lock);
+    RwLock_WriteUnlock(lock);
+
+    Task_Terminate();
+}
+
+void Task_P3()
+{
+    RwLock_ReadLock(lock);
+
+    while (!tried) {
+    }
+
+    RwLock_ReadUnlock(lock);
+
+    for(;;){
+    }
+}
+
+void a_main()
+{
+    lock = RwLock_Init();
+
+    Task_Create(Task_P1, 1, 0);
+    Task_Create(Task_P2, 2, 0);
+    Task_Create(Task_P3, 3, 0);
+
+    Task_Terminate();
+}